@@ -15,9 +15,16 @@
 #include <stdlib.h>
 #include <alsa/asoundlib.h>
 #include <gtk/gtk.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "snth.h"
+#include "osc.h"
+#include "rt.h"
 
 #define SEQ_NAME "LibSNTH GUI"
 #define PERF 1
@@ -47,8 +54,38 @@ static unsigned int      buffer_time = (1000000 * BUFFER / RATE);
 
 static short *buffer;
 
-static snd_pcm_t *pcm;
-static snd_seq_t *seq;
+static snd_pcm_t         *pcm;
+static snd_pcm_access_t   pcm_access;
+static struct snth_format pcm_format = { SNTH_FORMAT_S16, 0, 0 };
+static snd_seq_t         *seq;
+static int                seq_queue;
+static double             seq_start;
+
+/*---------------------------------------------------------------------------*/
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (double) t.tv_sec + (double) t.tv_nsec / 1000000000.0;
+}
+
+static void pcm_clock(snd_pcm_t *pcm)
+{
+    snd_pcm_uframes_t avail;
+    snd_htimestamp_t  t;
+
+    /* The next frame written plays once all queued frames have played. */
+    /* Fall back on the current time before the stream has a timestamp. */
+
+    if (snd_pcm_htimestamp(pcm, &avail, &t) == 0 && (t.tv_sec || t.tv_nsec))
+        snth_set_clock((double) t.tv_sec + (double) t.tv_nsec / 1000000000.0
+                     + (double) (buffer_size - avail) / RATE);
+    else
+        snth_set_clock(now());
+}
 
 /*---------------------------------------------------------------------------*/
 
@@ -75,6 +112,75 @@ static void pcm_xrun(int e)
     snd_pcm_prepare(pcm);
 }
 
+static void pcm_start(snd_pcm_t *pcm)
+{
+    /* A mapped stream does not start itself as a written one does.  Start */
+    /* it once the buffer is full, as the start threshold asks.            */
+
+    if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED &&
+        snd_pcm_avail_update(pcm) == 0)
+        snd_pcm_start(pcm);
+}
+
+static int pcm_mmap(snd_pcm_t *pcm, snd_pcm_uframes_t count)
+{
+    const snd_pcm_channel_area_t *a;
+
+    snd_pcm_uframes_t o;
+    snd_pcm_uframes_t n;
+    snd_pcm_sframes_t e;
+
+    void *dst[2];
+    int   v = 0;
+
+    /* Render straight into the device buffer, in pieces where it wraps. */
+
+    while (count > 0)
+    {
+        n = count;
+
+        if ((e = snd_pcm_mmap_begin(pcm, &a, &o, &n)) < 0)
+        {
+            pcm_xrun((int) e);
+            break;
+        }
+
+        dst[0] = (char *) a[0].addr + (a[0].first + o * a[0].step) / 8;
+        dst[1] = (char *) a[1].addr + (a[1].first + o * a[1].step) / 8;
+
+        v = snth_render(dst, n, &pcm_format);
+
+        if ((e = snd_pcm_mmap_commit(pcm, o, n)) < 0)
+        {
+            pcm_xrun((int) e);
+            break;
+        }
+        pcm_start(pcm);
+
+        count -= n;
+    }
+    return v;
+}
+
+static int pcm_write(snd_pcm_t *pcm, snd_pcm_uframes_t count)
+{
+    void *dst[1] = { buffer };
+    int   v;
+    int   e;
+
+    /* Render to the working buffer only if the device cannot be mapped. */
+
+    if (pcm_access != SND_PCM_ACCESS_RW_INTERLEAVED)
+        return pcm_mmap(pcm, count);
+
+    v = snth_render(dst, count, &pcm_format);
+
+    if ((e = snd_pcm_writei(pcm, buffer, count)) < 0)
+        pcm_xrun(e);
+
+    return v;
+}
+
 #if PERF
 static void pcm_chunk(snd_pcm_t *pcm, snd_pcm_sframes_t count)
 {
@@ -85,20 +191,13 @@ static void pcm_chunk(snd_pcm_t *pcm, snd_pcm_sframes_t count)
     struct timeval t0;
     struct timeval t1;
 
-    int e;
-
-    /* Get a chunk of audio from the synthesizer. */
+    /* Render a chunk of audio to the PCM output.  Patch edits publish */
+    /* new versions without blocking it.                               */
 
-    g_mutex_lock(mutex);
     gettimeofday(&t0, NULL);
-    n += snth_get_output(buffer, count);
+    pcm_clock(pcm);
+    n += pcm_write(pcm, count);
     gettimeofday(&t1, NULL);
-    g_mutex_unlock(mutex);
-
-    /* Send it to the PCM audio output. */
-
-    if ((e = snd_pcm_writei(pcm, buffer, count)) < 0)
-        pcm_xrun(e);
 
     /* Dump some performance statistics. */
 
@@ -121,18 +220,11 @@ static void pcm_chunk(snd_pcm_t *pcm, snd_pcm_sframes_t count)
 #else
 static void pcm_chunk(snd_pcm_t *pcm, snd_pcm_sframes_t count)
 {
-    int e;
+    /* Render a chunk of audio to the PCM output.  Patch edits publish */
+    /* new versions without blocking it.                               */
 
-    /* Get a chunk of audio from the synthesizer. */
-
-    g_mutex_lock(mutex);
-    snth_get_output(buffer, count);
-    g_mutex_unlock(mutex);
-
-    /* Send it to the PCM audio output. */
-
-    if ((e = snd_pcm_writei(pcm, buffer, count)) < 0)
-        pcm_xrun(e);
+    pcm_clock(pcm);
+    pcm_write(pcm, count);
 
 #if FOUT
     fwrite(buffer, 4, count, stdout);
@@ -164,6 +256,35 @@ static void pcm_proc(void)
         pcm_xrun(avail);
 }
 
+/* Access modes and formats are taken in order of preference.  Mapped     */
+/* access lets the synthesizer convert its output straight into the device */
+/* buffer.  File output needs the working buffer.                          */
+
+static const snd_pcm_access_t pcm_accesses[] = {
+#if !FOUT
+    SND_PCM_ACCESS_MMAP_INTERLEAVED,
+    SND_PCM_ACCESS_MMAP_NONINTERLEAVED,
+#endif
+    SND_PCM_ACCESS_RW_INTERLEAVED,
+};
+
+static const struct
+{
+    snd_pcm_format_t alsa;
+    int              snth;
+}
+pcm_formats[] = {
+    { SND_PCM_FORMAT_S16,   SNTH_FORMAT_S16 },
+#if !FOUT
+    { SND_PCM_FORMAT_S32,   SNTH_FORMAT_S32 },
+    { SND_PCM_FORMAT_S24,   SNTH_FORMAT_S24 },
+    { SND_PCM_FORMAT_FLOAT, SNTH_FORMAT_F32 },
+#endif
+};
+
+#define NACCESS (sizeof (pcm_accesses) / sizeof (pcm_accesses[0]))
+#define NFORMAT (sizeof (pcm_formats)  / sizeof (pcm_formats[0]))
+
 static void pcm_init(void)
 {
 /*
@@ -175,12 +296,14 @@ static void pcm_init(void)
     snd_async_handler_t *handler;
 */
     snd_pcm_stream_t stream = SND_PCM_STREAM_PLAYBACK;
-    snd_pcm_access_t access = SND_PCM_ACCESS_RW_INTERLEAVED;
-    snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
+    snd_pcm_format_t format;
 
     unsigned int channels = 2;
     unsigned int rate     = RATE;
 
+    size_t i;
+    size_t j;
+
     int d = 1;
 
     snd_ck(snd_pcm_open(&pcm, "plughw:0,0", stream, 0));
@@ -190,7 +313,25 @@ static void pcm_init(void)
     snd_ck(snd_pcm_hw_params_malloc(&hw));
 
     snd_ck(snd_pcm_hw_params_any                 (pcm, hw));
-    snd_ck(snd_pcm_hw_params_set_access          (pcm, hw, access));
+
+    /* Take the first access mode and format that the device offers. */
+
+    for (i = 0; i < NACCESS - 1; ++i)
+        if (snd_pcm_hw_params_test_access(pcm, hw, pcm_accesses[i]) == 0)
+            break;
+
+    pcm_access = pcm_accesses[i];
+
+    snd_ck(snd_pcm_hw_params_set_access          (pcm, hw, pcm_access));
+
+    for (j = 0; j < NFORMAT - 1; ++j)
+        if (snd_pcm_hw_params_test_format(pcm, hw, pcm_formats[j].alsa) == 0)
+            break;
+
+    format            = pcm_formats[j].alsa;
+    pcm_format.type   = pcm_formats[j].snth;
+    pcm_format.planar = (pcm_access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
+
     snd_ck(snd_pcm_hw_params_set_format          (pcm, hw, format));
     snd_ck(snd_pcm_hw_params_set_channels        (pcm, hw, channels));
     snd_ck(snd_pcm_hw_params_set_rate_near       (pcm, hw, &rate, 0));
@@ -212,14 +353,19 @@ static void pcm_init(void)
     snd_ck(snd_pcm_sw_params_set_avail_min      (pcm, sw, period_size));
     snd_ck(snd_pcm_sw_params_set_start_threshold(pcm, sw, buffer_size));
     snd_ck(snd_pcm_sw_params_set_xfer_align     (pcm, sw, 1));
+    snd_ck(snd_pcm_sw_params_set_tstamp_mode    (pcm, sw,
+                                                 SND_PCM_TSTAMP_ENABLE));
+    snd_ck(snd_pcm_sw_params_set_tstamp_type    (pcm, sw,
+                                         SND_PCM_TSTAMP_TYPE_MONOTONIC));
     snd_ck(snd_pcm_sw_params                    (pcm, sw));
 
     snd_pcm_sw_params_free(sw);
 
-    /* Acquire a working buffer. */
+    /* Acquire a working buffer, if the device cannot be mapped. */
 
-    buffer = (short *) calloc(period_size * channels,
-                              snd_pcm_format_width(format) / 8);
+    if (pcm_access == SND_PCM_ACCESS_RW_INTERLEAVED)
+        buffer = (short *) calloc(period_size * channels,
+                                  snd_pcm_format_width(format) / 8);
 
     /* Begin processing audio. */
 /*
@@ -260,6 +406,10 @@ static void seq_init(void)
 
         snd_seq_set_client_name(seq, SEQ_NAME);
 
+        /* Create a queue to stamp incoming events with real time. */
+
+        seq_queue = snd_seq_alloc_named_queue(seq, SEQ_NAME);
+
         /* Create a writable port. */
 
         snd_seq_create_simple_port(seq, SEQ_NAME,
@@ -279,37 +429,82 @@ static void seq_init(void)
         snd_seq_port_subscribe_set_sender(subs, &sender);
         snd_seq_port_subscribe_set_dest  (subs, &dest);
 
+        snd_seq_port_subscribe_set_queue      (subs, seq_queue);
+        snd_seq_port_subscribe_set_time_update(subs, 1);
+        snd_seq_port_subscribe_set_time_real  (subs, 1);
+
         snd_seq_subscribe_port(seq, subs);
+
+        /* Start the queue, noting its zero on the monotonic clock. */
+
+        snd_seq_start_queue(seq, seq_queue, NULL);
+        snd_seq_drain_output(seq);
+
+        seq_start = now();
     }
 }
 
+/* Events play a fixed latency after their stamp: a full PCM buffer plus a   */
+/* period, covering the wait for the next render and the queued output.      */
+
+static double seq_time(const snd_seq_event_t *e)
+{
+    const double l = (double) (buffer_size + period_size) / RATE;
+
+    if (snd_seq_ev_is_real(e))
+        return seq_start + l + (double) e->time.time.tv_sec
+                             + (double) e->time.time.tv_nsec / 1000000000.0;
+    else
+        return now() + l;
+}
+
+static void seq_send(double t, uint8_t s, int a, int b, size_t n)
+{
+    uint8_t d[3] = { s, (uint8_t) (a & 0x7F), (uint8_t) (b & 0x7F) };
+
+    snth_send_midi_at(t, d, n);
+}
+
 static void seq_step(void)
 {
     do
     {
         snd_seq_event_t *e;
+        snd_seq_ev_ctrl_t *c;
+        double t;
+        int    v;
 
         snd_seq_event_input(seq, &e);
 
+        c = &e->data.control;
+        t = seq_time(e);
+
         switch (e->type)
         {
         case SND_SEQ_EVENT_NOTEON:
-            g_mutex_lock(mutex);
-
-            snth_note_on(e->data.control.channel,
-                         e->data.note.note,
-                         e->data.note.velocity);
-
-            g_mutex_unlock(mutex);
+            seq_send(t, 0x90 | e->data.note.channel, e->data.note.note,
+                                                     e->data.note.velocity, 3);
             break;
         case SND_SEQ_EVENT_NOTEOFF:
-            g_mutex_lock(mutex);
-
-            snth_note_off(e->data.control.channel,
-                          e->data.note.note,
-                          e->data.note.velocity);
-
-            g_mutex_unlock(mutex);
+            seq_send(t, 0x80 | e->data.note.channel, e->data.note.note,
+                                                     e->data.note.velocity, 3);
+            break;
+        case SND_SEQ_EVENT_KEYPRESS:
+            seq_send(t, 0xA0 | e->data.note.channel, e->data.note.note,
+                                                     e->data.note.velocity, 3);
+            break;
+        case SND_SEQ_EVENT_CONTROLLER:
+            seq_send(t, 0xB0 | c->channel, c->param, c->value, 3);
+            break;
+        case SND_SEQ_EVENT_PGMCHANGE:
+            seq_send(t, 0xC0 | c->channel, c->value, 0, 2);
+            break;
+        case SND_SEQ_EVENT_CHANPRESS:
+            seq_send(t, 0xD0 | c->channel, c->value, 0, 2);
+            break;
+        case SND_SEQ_EVENT_PITCHBEND:
+            v = c->value + 8192;
+            seq_send(t, 0xE0 | c->channel, v, v >> 7, 3);
             break;
         }
 
@@ -338,11 +533,16 @@ static void seq_main(void)
 /*===========================================================================*/
 /* GUI implementation                                                        */
 
-static GtkObject *update;
-static int        depth = 0;
+static GtkObject        *update;
+static int               depth = 0;
+static struct snth_state state;
 
 static void update_event(void)
 {
+    /* Take one snapshot of the synth state for all widgets to read. */
+
+    snth_get_state(&state);
+
     depth++;
     g_signal_emit_by_name(update, "value_changed");
     depth--;
@@ -464,9 +664,7 @@ static void get_patch_name(GtkWidget *widget, GtkEntry *entry)
 
     /* Apply the patch name to the  text entry string. */
 
-    g_mutex_lock(mutex);
-    name = snth_get_patch_name();
-    g_mutex_unlock(mutex);
+    name = state.patch_name;
 
     gtk_entry_set_text(entry, name);
 }
@@ -869,9 +1067,7 @@ static void get_tone_wave(GtkWidget *widget, GtkComboBox *combo)
 
     /* Apply the LFO wave value to the combo. */
 
-    g_mutex_lock(mutex);
-    wave = snth_get_tone_wave(tone);
-    g_mutex_unlock(mutex);
+    wave = state.tone[tone].wave;
 
     gtk_combo_box_set_active(combo, wave);
 }
@@ -883,9 +1079,7 @@ static void get_tone_mode(GtkWidget *widget, GtkComboBox *combo)
 
     /* Apply the LFO mode value to the combo. */
 
-    g_mutex_lock(mutex);
-    mode = snth_get_tone_mode(tone);
-    g_mutex_unlock(mutex);
+    mode = state.tone[tone].mode;
 
     gtk_combo_box_set_active(combo, mode);
 }
@@ -897,9 +1091,7 @@ static void get_tone_level(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone level value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    level = snth_get_tone_level(tone);
-    g_mutex_unlock(mutex);
+    level = state.tone[tone].level;
 
     gtk_adjustment_set_value(value, level);
 }
@@ -911,9 +1103,7 @@ static void get_tone_pan(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone pan value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    pan = snth_get_tone_pan(tone);
-    g_mutex_unlock(mutex);
+    pan = state.tone[tone].pan;
 
     gtk_adjustment_set_value(value, pan);
 }
@@ -925,9 +1115,7 @@ static void get_tone_delay(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone delay value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    delay = snth_get_tone_delay(tone);
-    g_mutex_unlock(mutex);
+    delay = state.tone[tone].delay;
 
     gtk_adjustment_set_value(value, delay);
 }
@@ -939,9 +1127,7 @@ static void get_tone_pitch_coarse(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone coarse tuning value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    pitch_coarse = snth_get_tone_pitch_coarse(tone);
-    g_mutex_unlock(mutex);
+    pitch_coarse = state.tone[tone].pitch_coarse;
 
     gtk_adjustment_set_value(value, pitch_coarse);
 }
@@ -953,9 +1139,7 @@ static void get_tone_pitch_fine(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone fine tuning value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    pitch_fine = snth_get_tone_pitch_fine(tone);
-    g_mutex_unlock(mutex);
+    pitch_fine = state.tone[tone].pitch_fine;
 
     gtk_adjustment_set_value(value, pitch_fine);
 }
@@ -967,9 +1151,7 @@ static void get_tone_pitch_env(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone pitch envelope value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    pitch_env = snth_get_tone_pitch_env(tone);
-    g_mutex_unlock(mutex);
+    pitch_env = state.tone[tone].pitch_env;
 
     gtk_adjustment_set_value(value, pitch_env);
 }
@@ -981,9 +1163,7 @@ static void get_tone_filter_mode(GtkWidget *widget, GtkComboBox *combo)
 
     /* Apply the tone filter mode value to the combo. */
 
-    g_mutex_lock(mutex);
-    filter_mode = snth_get_tone_filter_mode(tone);
-    g_mutex_unlock(mutex);
+    filter_mode = state.tone[tone].filter_mode;
 
     gtk_combo_box_set_active(combo, filter_mode);
 }
@@ -995,9 +1175,7 @@ static void get_tone_filter_cut(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone filter cutoff value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    filter_cut = snth_get_tone_filter_cut(tone);
-    g_mutex_unlock(mutex);
+    filter_cut = state.tone[tone].filter_cut;
 
     gtk_adjustment_set_value(value, filter_cut);
 }
@@ -1009,9 +1187,7 @@ static void get_tone_filter_res(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone filter resonance value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    filter_res = snth_get_tone_filter_res(tone);
-    g_mutex_unlock(mutex);
+    filter_res = state.tone[tone].filter_res;
 
     gtk_adjustment_set_value(value, filter_res);
 }
@@ -1023,9 +1199,7 @@ static void get_tone_filter_env(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone filter envelope value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    filter_env = snth_get_tone_filter_env(tone);
-    g_mutex_unlock(mutex);
+    filter_env = state.tone[tone].filter_env;
 
     gtk_adjustment_set_value(value, filter_env);
 }
@@ -1037,9 +1211,7 @@ static void get_tone_filter_key(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone filter key follow value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    filter_key = snth_get_tone_filter_key(tone);
-    g_mutex_unlock(mutex);
+    filter_key = state.tone[tone].filter_key;
 
     gtk_adjustment_set_value(value, filter_key);
 }
@@ -1054,9 +1226,7 @@ static void get_tone_env_a(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone envelope attack value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    a = snth_get_tone_env_a(tone, env);
-    g_mutex_unlock(mutex);
+    a = state.tone[tone].env[env].a;
 
     gtk_adjustment_set_value(value, a);
 }
@@ -1069,9 +1239,7 @@ static void get_tone_env_d(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone envelope decay value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    d = snth_get_tone_env_d(tone, env);
-    g_mutex_unlock(mutex);
+    d = state.tone[tone].env[env].d;
 
     gtk_adjustment_set_value(value, d);
 }
@@ -1084,9 +1252,7 @@ static void get_tone_env_s(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone envelope sustain value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    s = snth_get_tone_env_s(tone, env);
-    g_mutex_unlock(mutex);
+    s = state.tone[tone].env[env].s;
 
     gtk_adjustment_set_value(value, s);
 }
@@ -1099,9 +1265,7 @@ static void get_tone_env_r(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the tone envelope release value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    r = snth_get_tone_env_r(tone, env);
-    g_mutex_unlock(mutex);
+    r = state.tone[tone].env[env].r;
 
     gtk_adjustment_set_value(value, r);
 }
@@ -1116,9 +1280,7 @@ static void get_tone_lfo_wave(GtkWidget *widget, GtkComboBox *combo)
 
     /* Apply the LFO wave value to the combo. */
 
-    g_mutex_lock(mutex);
-    wave = snth_get_tone_lfo_wave(tone, lfo);
-    g_mutex_unlock(mutex);
+    wave = state.tone[tone].lfo[lfo].wave;
 
     gtk_combo_box_set_active(combo, wave);
 }
@@ -1131,9 +1293,7 @@ static void get_tone_lfo_sync(GtkWidget *widget, GtkToggleButton *check)
 
     /* Apply the LFO sync value to the check button. */
 
-    g_mutex_lock(mutex);
-    sync = snth_get_tone_lfo_sync(tone, lfo);
-    g_mutex_unlock(mutex);
+    sync = state.tone[tone].lfo[lfo].sync;
 
     gtk_toggle_button_set_active(check, sync ? TRUE : FALSE);
 }
@@ -1146,9 +1306,7 @@ static void get_tone_lfo_rate(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the LFO rate value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    rate = snth_get_tone_lfo_rate(tone, lfo);
-    g_mutex_unlock(mutex);
+    rate = state.tone[tone].lfo[lfo].rate;
 
     gtk_adjustment_set_value(value, rate);
 }
@@ -1161,9 +1319,7 @@ static void get_tone_lfo_delay(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the LFO delay value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    delay = snth_get_tone_lfo_delay(tone, lfo);
-    g_mutex_unlock(mutex);
+    delay = state.tone[tone].lfo[lfo].delay;
 
     gtk_adjustment_set_value(value, delay);
 }
@@ -1176,9 +1332,7 @@ static void get_tone_lfo_level(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the LFO level send value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    level = snth_get_tone_lfo_level(tone, lfo);
-    g_mutex_unlock(mutex);
+    level = state.tone[tone].lfo[lfo].level;
 
     gtk_adjustment_set_value(value, level);
 }
@@ -1191,9 +1345,7 @@ static void get_tone_lfo_pan(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the LFO pan send value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    pan = snth_get_tone_lfo_pan(tone, lfo);
-    g_mutex_unlock(mutex);
+    pan = state.tone[tone].lfo[lfo].pan;
 
     gtk_adjustment_set_value(value, pan);
 }
@@ -1206,9 +1358,7 @@ static void get_tone_lfo_pitch(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the LFO pitch send value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    pitch = snth_get_tone_lfo_pitch(tone, lfo);
-    g_mutex_unlock(mutex);
+    pitch = state.tone[tone].lfo[lfo].pitch;
 
     gtk_adjustment_set_value(value, pitch);
 }
@@ -1221,9 +1371,7 @@ static void get_tone_lfo_phase(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the LFO phase send value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    phase = snth_get_tone_lfo_phase(tone, lfo);
-    g_mutex_unlock(mutex);
+    phase = state.tone[tone].lfo[lfo].phase;
 
     gtk_adjustment_set_value(value, phase);
 }
@@ -1236,9 +1384,7 @@ static void get_tone_lfo_filter(GtkWidget *widget, GtkAdjustment *value)
 
     /* Apply the LFO filter send value to the adjustment. */
 
-    g_mutex_lock(mutex);
-    filter = snth_get_tone_lfo_filter(tone, lfo);
-    g_mutex_unlock(mutex);
+    filter = state.tone[tone].lfo[lfo].filter;
 
     gtk_adjustment_set_value(value, filter);
 }
@@ -2244,7 +2390,15 @@ static gpointer do_gui(gpointer data)
 
 static gpointer do_pcm(gpointer data)
 {
+    const char *rt = getenv("SNTH_RT");
+
+    /* If SNTH_RT gives a policy, render audio in real-time mode. */
+
     pcm_init();
+
+    if (rt)
+        rt_init(rt);
+
     pcm_main();
 
     return NULL;
@@ -2260,6 +2414,51 @@ static gpointer do_seq(gpointer data)
 
 /*---------------------------------------------------------------------------*/
 
+static struct snth_shared *shared = NULL;
+
+static void shared_init(void)
+{
+    const size_t sz   = sizeof (struct snth_shared);
+    const char  *name = getenv("SNTH_SHARED");
+
+    void *p;
+    int   fd;
+
+    /* If SNTH_SHARED names a shared memory object, map a parameter table */
+    /* there, formatting it if new, and attach it to the synthesizer.     */
+
+    if (name && (fd = shm_open(name, O_RDWR | O_CREAT, 0600)) >= 0)
+    {
+        if (ftruncate(fd, sz) == 0)
+        {
+            p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (p != MAP_FAILED)
+            {
+                shared = (struct snth_shared *) p;
+
+                if (shared->magic != SNTH_SHARED_MAGIC)
+                    snth_init_shared(shared);
+
+                snth_set_shared(shared);
+            }
+        }
+        close(fd);
+    }
+}
+
+static void shared_fini(void)
+{
+    if (shared)
+    {
+        snth_set_shared(NULL);
+        munmap(shared, sizeof (struct snth_shared));
+        shared = NULL;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
 #define MAXMIDI 65536
 
 static void init(int argc, char *argv[])
@@ -2268,6 +2467,7 @@ static void init(int argc, char *argv[])
 
     FILE  *fp;
     size_t sz;
+    char  *port;
 
     /* If a file was named on the command line, read SNTH state from it. */
 
@@ -2282,6 +2482,13 @@ static void init(int argc, char *argv[])
     snth_set_channel(0);
     snth_set_bank   (0);
     snth_set_patch(0);
+
+    shared_init();
+
+    /* If SNTH_OSC names a port, receive OSC there with the MIDI latency. */
+
+    if ((port = getenv("SNTH_OSC")))
+        osc_init(atoi(port), (double) (BUFFER + PERIOD) / RATE);
 }
 
 static void fini(int argc, char *argv[])
@@ -2291,6 +2498,9 @@ static void fini(int argc, char *argv[])
     FILE  *fp;
     size_t sz;
 
+    osc_fini();
+    shared_fini();
+
     /* If a file was named on the command line, write SNTH state to it. */
 
     if ((argc > 1) && (fp = fopen(argv[1], "wb")))
@@ -0,0 +1,531 @@
+/*    Copyright (C) 2005 Robert Kooima                                       */
+/*                                                                           */
+/*    SNTHGUI is free software;  you can redistribute it and/or modify it    */
+/*    under the terms of the  GNU General Public License  as published by    */
+/*    the  Free Software Foundation;  either version 2 of the License, or    */
+/*    (at your option) any later version.                                    */
+/*                                                                           */
+/*    This program is distributed in the hope that it will be useful, but    */
+/*    WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of    */
+/*    MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU    */
+/*    General Public License for more details.                               */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "snth.h"
+#include "osc.h"
+
+#define MAXPACKET 65536
+#define MAXBATCH    512
+#define MAXBLOB    4096
+#define MAXDEPTH      8
+
+#define NTP_UNIX 2208988800.0
+
+/*---------------------------------------------------------------------------*/
+
+static pthread_t    osc_thread;
+static int          osc_sock  = -1;
+static volatile int osc_quit  = 0;
+static double       osc_delay = 0.0;
+
+/*===========================================================================*/
+
+/* A batch gathers the messages of one bundle into a single ring record:     */
+/* one SNTH SysEx holding every parameter, applied as a single bulk edit,    */
+/* followed by all other MIDI in order.  A large bundle is sent as several   */
+/* records, each small enough that many wait in the event queue together.   */
+/* Each record is then a separate bulk edit, so such a bundle is applied at  */
+/* its timetag, but not as a whole.                                          */
+
+struct batch
+{
+    double  time;
+    int     now;
+    int     patch;
+    size_t  n;
+    size_t  m;
+    uint8_t midi [MAXBATCH];
+    uint8_t sysex[MAXBATCH];
+};
+
+static void batch_init(struct batch *B, double time, int now)
+{
+    B->time  = time;
+    B->now   = now;
+    B->patch = -1;
+    B->n     = 0;
+    B->m     = 0;
+}
+
+static void batch_post(struct batch *B, const uint8_t *d, size_t n)
+{
+    const struct timespec wait = { 0, 1000000 };
+
+    /* Wait for the audio thread to make room in the ring, as needed. */
+
+    while (!osc_quit && !(B->now ? snth_send_midi   (0,       d, n)
+                                 : snth_send_midi_at(B->time, d, n)))
+        nanosleep(&wait, NULL);
+}
+
+static void batch_send(struct batch *B)
+{
+    uint8_t d[MAXBATCH * 2 + 3];
+    size_t  n = 0;
+
+    if (B->n == 0 && B->m == 0)
+        return;
+
+    /* Assemble the record. */
+
+    if (B->m)
+    {
+        d[n++] = 0xF0;
+        d[n++] = SNTH_SYSEX;
+        memcpy(d + n, B->sysex, B->m);
+        n += B->m;
+        d[n++] = 0xF7;
+    }
+    memcpy(d + n, B->midi, B->n);
+    n += B->n;
+
+    batch_post(B, d, n);
+    batch_init(B, B->time, B->now);
+}
+
+static void batch_midi(struct batch *B, const uint8_t *d, size_t n)
+{
+    /* A blob too long to batch, such as a long SysEx, cannot be split and */
+    /* follows all gathered before it in a record of its own.  One too     */
+    /* long for the event ring is reported and dropped.                    */
+
+    if (n > MAXBATCH)
+    {
+        batch_send(B);
+
+        if (n > MAXBLOB)
+            fprintf(stderr, "OSC: %lu-byte MIDI blob dropped\n",
+                    (unsigned long) n);
+        else
+            batch_post(B, d, n);
+        return;
+    }
+    if (B->n + n > MAXBATCH)
+        batch_send(B);
+
+    memcpy(B->midi + B->n, d, n);
+    B->n += n;
+}
+
+static void batch_param(struct batch *B, int patch, int tone, int param,
+                                                              int value)
+{
+    /* Select the patch to edit when it changes. */
+
+    if (B->m + 4 > MAXBATCH)
+        batch_send(B);
+
+    if (B->patch != patch)
+    {
+        B->sysex[B->m++] = 0x03;
+        B->sysex[B->m++] = (uint8_t) patch;
+        B->patch         = patch;
+    }
+
+    B->sysex[B->m++] = (uint8_t) (param | (tone << 4));
+    B->sysex[B->m++] = (uint8_t) (value & 0x7F);
+}
+
+/*===========================================================================*/
+
+/* OSC message arguments are read as integers, whatever their type.         */
+
+#define MAXARG 8
+
+struct message
+{
+    const char    *addr;
+    int            argc;
+    int            argv[MAXARG];
+    const uint8_t *blob;
+    size_t         blob_n;
+};
+
+static uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+         | ((uint32_t) p[2] <<  8) | ((uint32_t) p[3]);
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    return ((uint64_t) get32(p) << 32) | get32(p + 4);
+}
+
+static size_t pad4(size_t n)
+{
+    return (n + 3) & ~(size_t) 3;
+}
+
+static size_t get_string(const uint8_t *p, size_t n)
+{
+    const uint8_t *z = memchr(p, 0, n);
+
+    /* Return the padded length of a string, or zero if malformed. */
+
+    return (z && pad4(z - p + 1) <= n) ? pad4(z - p + 1) : 0;
+}
+
+static int get_message(struct message *M, const uint8_t *p, size_t n)
+{
+    const char *t;
+    size_t      i = 0;
+    size_t      k;
+    union { uint32_t u; float f; } u32;
+    union { uint64_t u; double d; } u64;
+
+    /* Read the address and the type tag string. */
+
+    if ((k = get_string(p, n)) == 0)
+        return 0;
+
+    M->addr   = (const char *) p;
+    M->argc   = 0;
+    M->blob   = NULL;
+    M->blob_n = 0;
+
+    i += k;
+
+    if (i == n)
+        return 1;
+    if (p[i] != ',' || (k = get_string(p + i, n - i)) == 0)
+        return 0;
+
+    t  = (const char *) p + i + 1;
+    i += k;
+
+    /* Read each argument. */
+
+    for (; *t; ++t)
+    {
+        int v = 0;
+
+        switch (*t)
+        {
+        case 'i':
+            if (i + 4 > n) return 0;
+            v = (int32_t) get32(p + i);
+            i += 4;
+            break;
+        case 'f':
+            if (i + 4 > n) return 0;
+            u32.u = get32(p + i);
+            v = (int) u32.f;
+            i += 4;
+            break;
+        case 'h':
+        case 't':
+            if (i + 8 > n) return 0;
+            v = (int) (int64_t) get64(p + i);
+            i += 8;
+            break;
+        case 'd':
+            if (i + 8 > n) return 0;
+            u64.u = get64(p + i);
+            v = (int) u64.d;
+            i += 8;
+            break;
+        case 's':
+        case 'S':
+            if ((k = get_string(p + i, n - i)) == 0) return 0;
+            i += k;
+            break;
+        case 'b':
+            if (i + 4 > n) return 0;
+            k = get32(p + i);
+            if (k > n - i - 4) return 0;
+            M->blob   = p + i + 4;
+            M->blob_n = k;
+            i += 4 + pad4(k);
+            break;
+        case 'T':
+            v = 1;
+            break;
+        case 'F':
+        case 'N':
+        case 'I':
+            break;
+        default:
+            return 0;
+        }
+
+        if (M->argc < MAXARG)
+            M->argv[M->argc++] = v;
+    }
+    return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Messages are dispatched by address.  Each handler takes the number of     */
+/* integer arguments it names, clamped to the range of its MIDI fields.      */
+
+typedef void (*message_fn)(struct batch *, const int *);
+
+static void put_midi3(struct batch *B, int s, int a, int b)
+{
+    uint8_t d[3] = { (uint8_t) s, (uint8_t) (a & 0x7F), (uint8_t) (b & 0x7F) };
+
+    batch_midi(B, d, 3);
+}
+
+static void msg_note_on(struct batch *B, const int *v)
+{
+    put_midi3(B, 0x90 | (v[0] & 0x0F), v[1], v[2]);
+}
+
+static void msg_note_off(struct batch *B, const int *v)
+{
+    put_midi3(B, 0x80 | (v[0] & 0x0F), v[1], v[2]);
+}
+
+static void msg_control(struct batch *B, const int *v)
+{
+    put_midi3(B, 0xB0 | (v[0] & 0x0F), v[1], v[2]);
+}
+
+static void msg_program(struct batch *B, const int *v)
+{
+    uint8_t d[2] = { (uint8_t) (0xC0 | (v[0] & 0x0F)),
+                     (uint8_t) (v[1] & 0x7F) };
+
+    batch_midi(B, d, 2);
+}
+
+static void msg_bend(struct batch *B, const int *v)
+{
+    put_midi3(B, 0xE0 | (v[0] & 0x0F), v[1], v[1] >> 7);
+}
+
+static void msg_param(struct batch *B, const int *v)
+{
+    /* Accept only tone, envelope, and LFO codes with the tone bits clear. */
+
+    if (0 <= v[0] && v[0] < 128 && 0 <= v[1] && v[1] < 4
+                                && (v[2] & 0xC0) && !(v[2] & 0x30)
+                                && (v[2] | (v[1] << 4)) != 0xF7)
+        batch_param(B, v[0], v[1], v[2] & 0xFF, v[3]);
+}
+
+static const struct
+{
+    const char *addr;
+    int         argc;
+    message_fn  fn;
+}
+messages[] = {
+    { "/snth/note_on",  3, msg_note_on  },
+    { "/snth/note_off", 2, msg_note_off },
+    { "/snth/control",  3, msg_control  },
+    { "/snth/program",  2, msg_program  },
+    { "/snth/bend",     2, msg_bend     },
+    { "/snth/param",    4, msg_param    },
+};
+
+static void put_message(struct batch *B, const uint8_t *p, size_t n)
+{
+    struct message M;
+    size_t i;
+
+    if (get_message(&M, p, n) == 0)
+        return;
+
+    /* Raw MIDI passes through as is. */
+
+    if (strcmp(M.addr, "/snth/midi") == 0)
+    {
+        if (M.blob)
+            batch_midi(B, M.blob, M.blob_n);
+        return;
+    }
+
+    for (i = 0; i < sizeof (messages) / sizeof (messages[0]); ++i)
+        if (strcmp(M.addr, messages[i].addr) == 0)
+        {
+            if (M.argc >= messages[i].argc)
+            {
+                /* Note-off velocity is optional. */
+
+                if (M.argc < MAXARG)
+                    M.argv[M.argc] = 0;
+
+                messages[i].fn(B, M.argv);
+            }
+            return;
+        }
+}
+
+/*===========================================================================*/
+
+static double osc_time(uint64_t tag, double base)
+{
+    /* Convert an NTP timetag to the monotonic clock. */
+
+    return base + (double) (tag >> 32) - NTP_UNIX
+                + (double) (tag & 0xFFFFFFFF) / 4294967296.0;
+}
+
+static void put_packet(const uint8_t *p, size_t n, double time, int now,
+                       double base, int depth)
+{
+    struct batch B;
+    size_t i;
+
+    if (n < 4 || (n & 3) || depth > MAXDEPTH)
+        return;
+
+    /* A bundle sends its messages as one batch at its timetag.  Nested   */
+    /* bundles send their own.                                            */
+
+    if (n >= 16 && memcmp(p, "#bundle", 8) == 0)
+    {
+        const uint64_t tag = get64(p + 8);
+
+        if (tag != 1)
+        {
+            time = osc_time(tag, base);
+            now  = 0;
+        }
+
+        batch_init(&B, time, now);
+
+        for (i = 16; i + 4 <= n; )
+        {
+            const size_t k = get32(p + i);
+
+            if (k > n - i - 4 || (k & 3))
+                break;
+
+            if (k >= 8 && memcmp(p + i + 4, "#bundle", 8) == 0)
+            {
+                batch_send(&B);
+                put_packet(p + i + 4, k, time, now, base, depth + 1);
+            }
+            else
+                put_message(&B, p + i + 4, k);
+
+            i += 4 + k;
+        }
+        batch_send(&B);
+    }
+    else if (p[0] == '/')
+    {
+        batch_init(&B, time, now);
+        put_message(&B, p, n);
+        batch_send(&B);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static double clock_now(clockid_t c)
+{
+    struct timespec t;
+
+    clock_gettime(c, &t);
+
+    return (double) t.tv_sec + (double) t.tv_nsec / 1000000000.0;
+}
+
+static void *osc_main(void *data)
+{
+    static uint8_t p[MAXPACKET];
+
+    struct pollfd fd;
+    ssize_t n;
+
+    fd.fd     = osc_sock;
+    fd.events = POLLIN;
+
+    /* Receive packets until asked to quit, checking every 100ms. */
+
+    while (!osc_quit)
+        if (poll(&fd, 1, 100) > 0)
+            while ((n = recv(osc_sock, p, MAXPACKET, MSG_DONTWAIT)) > 0)
+            {
+                /* Timetags give wall-clock time.  Immediate messages play */
+                /* after the latency.                                      */
+
+                const double t = clock_now(CLOCK_MONOTONIC);
+                const double b = t - clock_now(CLOCK_REALTIME);
+
+                if (osc_delay > 0)
+                    put_packet(p, (size_t) n, t + osc_delay, 0, b, 0);
+                else
+                    put_packet(p, (size_t) n, t,             1, b, 0);
+            }
+
+    return NULL;
+}
+
+int osc_init(int port, double delay)
+{
+    struct sockaddr_in addr;
+    int size = MAXPACKET * 16;
+
+    /* Bind a UDP socket to the loopback interface, buffering enough to */
+    /* ride out bursts while the ring is full.                          */
+
+    if ((osc_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return 0;
+
+    setsockopt(osc_sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+
+    memset(&addr, 0, sizeof (addr));
+
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((uint16_t) port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(osc_sock, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+        close(osc_sock);
+        osc_sock = -1;
+        return 0;
+    }
+
+    /* Start the receiver. */
+
+    osc_quit  = 0;
+    osc_delay = delay;
+
+    if (pthread_create(&osc_thread, NULL, osc_main, NULL))
+    {
+        close(osc_sock);
+        osc_sock = -1;
+        return 0;
+    }
+    return 1;
+}
+
+void osc_fini(void)
+{
+    if (osc_sock >= 0)
+    {
+        osc_quit = 1;
+        pthread_join(osc_thread, NULL);
+        close(osc_sock);
+        osc_sock = -1;
+    }
+}
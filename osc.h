@@ -0,0 +1,43 @@
+/*    Copyright (C) 2005 Robert Kooima                                       */
+/*                                                                           */
+/*    SNTHGUI is free software;  you can redistribute it and/or modify it    */
+/*    under the terms of the  GNU General Public License  as published by    */
+/*    the  Free Software Foundation;  either version 2 of the License, or    */
+/*    (at your option) any later version.                                    */
+/*                                                                           */
+/*    This program is distributed in the hope that it will be useful, but    */
+/*    WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of    */
+/*    MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU    */
+/*    General Public License for more details.                               */
+
+#ifndef OSC_H
+#define OSC_H
+
+/*===========================================================================*/
+
+/* The OSC receiver listens for UDP packets on the loopback interface and    */
+/* sends their contents to the synthesizer's event ring, timed on the        */
+/* CLOCK_MONOTONIC clock that the audio thread passes to snth_set_clock.     */
+/* Each bundle is applied at its timetag, as one ring record and one bulk    */
+/* edit if it holds up to 128 parameters and 512 bytes of MIDI.  A larger    */
+/* bundle is split across several records and is not applied atomically.     */
+/* A MIDI blob longer than 4096 bytes is dropped.  Immediate messages play   */
+/* after the given latency in seconds.                                       */
+/*                                                                           */
+/*     /snth/note_on  chan pitch level                                       */
+/*     /snth/note_off chan pitch level                                       */
+/*     /snth/control  chan controller value                                  */
+/*     /snth/program  chan program                                           */
+/*     /snth/bend     chan value                                             */
+/*     /snth/param    patch tone param value                                 */
+/*     /snth/midi     blob                                                   */
+/*                                                                           */
+/* Parameters take SysEx tone, envelope, and LFO codes with the tone bits    */
+/* clear, as with snth_set_param.                                            */
+
+int  osc_init(int, double);
+void osc_fini(void);
+
+/*===========================================================================*/
+
+#endif
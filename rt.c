@@ -0,0 +1,131 @@
+/*    Copyright (C) 2005 Robert Kooima                                       */
+/*                                                                           */
+/*    SNTHGUI is free software;  you can redistribute it and/or modify it    */
+/*    under the terms of the  GNU General Public License  as published by    */
+/*    the  Free Software Foundation;  either version 2 of the License, or    */
+/*    (at your option) any later version.                                    */
+/*                                                                           */
+/*    This program is distributed in the hope that it will be useful, but    */
+/*    WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of    */
+/*    MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU    */
+/*    General Public License for more details.                               */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <xmmintrin.h>
+
+#include "rt.h"
+
+#define RT_PRIORITY 70
+#define RT_STACK    (256 * 1024)
+
+/*---------------------------------------------------------------------------*/
+
+static void rt_error(const char *str, int err)
+{
+    fprintf(stderr, "Real-time error: %s, %s\n", str, strerror(err));
+}
+
+static void rt_stack(void)
+{
+    volatile char stack[RT_STACK];
+
+    /* Fault in the stack the thread will render on, so that mlockall */
+    /* holds it.                                                      */
+
+    memset((char *) stack, 0, RT_STACK);
+}
+
+/*---------------------------------------------------------------------------*/
+
+int rt_init(const char *spec)
+{
+    struct sched_param param;
+    cpu_set_t          cpus;
+
+    char policy[8];
+    int  priority = RT_PRIORITY;
+    int  cpu      = -1;
+    int  ok       = 1;
+    int  e;
+    int  p;
+
+    /* Parse the policy, priority, and CPU. */
+
+    if (sscanf(spec, "%7[a-z]:%d:%d", policy, &priority, &cpu) < 1)
+    {
+        rt_error(spec, EINVAL);
+        return 0;
+    }
+
+    if      (strcmp(policy, "fifo") == 0)
+        p = SCHED_FIFO;
+    else if (strcmp(policy, "rr")   == 0)
+        p = SCHED_RR;
+    else
+    {
+        rt_error(spec, EINVAL);
+        return 0;
+    }
+
+    if (cpu >= CPU_SETSIZE)
+    {
+        rt_error(spec, EINVAL);
+        return 0;
+    }
+
+    /* Schedule the calling thread. */
+
+    memset(&param, 0, sizeof (param));
+
+    if (priority < sched_get_priority_min(p))
+        priority = sched_get_priority_min(p);
+    if (priority > sched_get_priority_max(p))
+        priority = sched_get_priority_max(p);
+
+    param.sched_priority = priority;
+
+    if ((e = pthread_setschedparam(pthread_self(), p, &param)))
+    {
+        rt_error("pthread_setschedparam", e);
+        ok = 0;
+    }
+
+    /* Pin it to a CPU, if one was named. */
+
+    if (cpu >= 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        if ((e = pthread_setaffinity_np(pthread_self(), sizeof (cpus), &cpus)))
+        {
+            rt_error("pthread_setaffinity_np", e);
+            ok = 0;
+        }
+    }
+
+    /* Lock and fault in all memory, including this thread's stack. */
+
+    rt_stack();
+
+    if (mlockall(MCL_CURRENT) < 0)
+    {
+        rt_error("mlockall", errno);
+        ok = 0;
+    }
+
+    /* Flush denormals to zero, as decaying filters and envelopes produce */
+    /* them and they are slow.                                            */
+
+    _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+
+    return ok;
+}
@@ -0,0 +1,30 @@
+/*    Copyright (C) 2005 Robert Kooima                                       */
+/*                                                                           */
+/*    SNTHGUI is free software;  you can redistribute it and/or modify it    */
+/*    under the terms of the  GNU General Public License  as published by    */
+/*    the  Free Software Foundation;  either version 2 of the License, or    */
+/*    (at your option) any later version.                                    */
+/*                                                                           */
+/*    This program is distributed in the hope that it will be useful, but    */
+/*    WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of    */
+/*    MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU    */
+/*    General Public License for more details.                               */
+
+#ifndef RT_H
+#define RT_H
+
+/*===========================================================================*/
+
+/* Real-time mode readies the calling thread to render audio.  It is given   */
+/* a scheduling policy, optionally followed by a priority and a CPU to pin   */
+/* the thread to, as in "fifo", "rr:60", or "fifo:80:3".  It locks all       */
+/* memory now mapped, faulting in the synthesizer's voices, buffers, and     */
+/* tables, so call it after snth_init and once the audio device is open.     */
+/* Threads created by the calling thread afterward inherit its policy.       */
+/* Each step that fails is reported and skipped.  Gives zero on any failure. */
+
+int rt_init(const char *);
+
+/*===========================================================================*/
+
+#endif
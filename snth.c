@@ -18,10 +18,14 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 
 #ifdef __SSE__
 #include <xmmintrin.h>
 #endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "snth.h"
 
@@ -35,15 +39,34 @@
 #define MAXPATCH   128
 #define MAXPITCH   128
 #define MAXNOTE    256
-#define MAXSTR     256
+#define MAXSTR     SNTH_MAXSTR
 #define MAXWAVE      5
 #define MAXMODE      4
-#define MAXTONE      4
-#define MAXENV       3
-#define MAXLFO       2
+#define MAXTONE    SNTH_MAXTONE
+#define MAXENV     SNTH_MAXENV
+#define MAXLFO     SNTH_MAXLFO
 #define MAXSINE    256
+#define MAXBUS      (MAXCHANNEL + 1)
+#define MAXREVERB  8192
+#define MAXCHORUS  4096
+#define MAXLINE      4
+#define MAXTAP       4
+#define MAXBAND      3
+#define MAXLIMIT    32
+#define MAXSPEAKER   8
+#define MAXPAIR      7
+#define MAXMETER    (MAXSPEAKER + 2 * MAXBUS)
+#define MAXEVENT  1024
+#define MAXEVDATA 8192
+#define MAXRING   8192
+
+#define MIXBUS     MAXCHANNEL
 
 #define NO_NOTE 0xFFFF
+#define NO_VERSION 0xFFFF
+
+#define MAXVERSION (2 * MAXPATCH + MAXNOTE)
+#define EDIT_WAIT  1000
 
 /*---------------------------------------------------------------------------*/
 
@@ -166,6 +189,14 @@ struct snth_osc
     float lfo_phase[2];
 
     struct snth_filter filter;
+
+    /* Smoothed parameter state */
+
+    int   ramp;
+    float sl;
+    float sc;
+    float sp;
+    float sk;
 };
 
 struct snth_note
@@ -176,6 +207,10 @@ struct snth_note
     uint8_t pitch;
     uint8_t level;
     uint8_t chan;
+    uint8_t press;
+    uint8_t held;
+
+    uint16_t version;
 
     /* Note evaluator state */
 
@@ -192,11 +227,160 @@ struct snth_channel
     uint8_t reverb;
     uint8_t chorus;
 
+    /* Insert config */
+
+    uint8_t eq_low;
+    uint8_t eq_mid;
+    uint8_t eq_freq;
+    uint8_t eq_high;
+    uint8_t drive;
+
+    /* Spatial config */
+
+    uint8_t azimuth;
+    uint8_t elevation;
+
+    /* Modulation state, set by MIDI controllers */
+
+    uint8_t  bank;
+    uint16_t mod_bend;
+    uint16_t mod_rpn;
+    uint8_t  mod_range;
+    uint8_t  mod_wheel;
+    uint8_t  mod_volume;
+    uint8_t  mod_pan;
+    uint8_t  mod_expression;
+    uint8_t  mod_sustain;
+    uint8_t  mod_pressure;
+
+    /* Modulation evaluator state cache */
+
+    float mb;
+    float mv;
+    float mk;
+    float mp;
+
+    /* Insert evaluator state cache */
+
+    float eq[MAXBAND][5];
+    float dk;
+
+    uint16_t flags;
+
+    /* Insert evaluator state */
+
+    float eqz[2][MAXBAND][2];
+
     uint16_t note[128];
 };
 
 /*---------------------------------------------------------------------------*/
 
+struct snth_reverb
+{
+    /* Reverb config */
+
+    uint8_t level;
+    uint8_t time;
+    uint8_t damp;
+    uint8_t size;
+
+    /* Reverb evaluator state cache */
+
+    int   len[MAXLINE];
+    float fb [MAXLINE];
+    float lp;
+    int   decay;
+
+    /* Reverb evaluator state */
+
+    int   pos[MAXLINE];
+    int   tail;
+    float state[MAXLINE];
+    float line [MAXLINE][MAXREVERB];
+};
+
+struct snth_chorus
+{
+    /* Chorus config */
+
+    uint8_t level;
+    uint8_t rate;
+    uint8_t depth;
+    uint8_t delay;
+
+    /* Chorus evaluator state cache */
+
+    float freq;
+    float base;
+    float width;
+
+    /* Chorus evaluator state */
+
+    int   pos;
+    int   tail;
+    float phase;
+    float line[MAXCHORUS];
+};
+
+struct snth_limiter
+{
+    /* Limiter config */
+
+    uint8_t level;
+    uint8_t release;
+
+    /* Limiter evaluator state cache */
+
+    float thr;
+    float rel;
+
+    /* Limiter evaluator state */
+
+    int   pos;
+    float gain;
+    float req[MAXLIMIT];
+    float min[MAXLIMIT];
+    float delay[MAXSPEAKER][MAXLIMIT * 4];
+};
+
+/*---------------------------------------------------------------------------*/
+
+struct snth_layout
+{
+    int   n;                    /* Number of output channels               */
+    int   lfe;                  /* Index of the LFE channel, or -1         */
+    int   m;                    /* Number of adjacent speaker pairs        */
+    float az[MAXSPEAKER];       /* Speaker azimuths in turns, left-positive */
+    int   pair[MAXPAIR][2];     /* Adjacent speakers in order of azimuth   */
+};
+
+/* Speakers follow WAV channel order: L R C LFE, then Ls Rs for 5.1, or Lb   */
+/* Rb Ls Rs for 7.1.  First-order ambisonics is W Y Z X, ACN order, SN3D.    */
+
+static const struct snth_layout layouts[] = {
+    { 2, -1, 0, { 0 }, { { 0 } } },
+    { 6,  3, 5, { +30 / 360.f, -30 / 360.f, 0, 0,
+                  +110 / 360.f, -110 / 360.f },
+                { { 5, 1 }, { 1, 2 }, { 2, 0 }, { 0, 4 }, { 4, 5 } } },
+    { 8,  3, 7, { +30 / 360.f, -30 / 360.f, 0, 0,
+                  +150 / 360.f, -150 / 360.f, +90 / 360.f, -90 / 360.f },
+                { { 5, 7 }, { 7, 1 }, { 1, 2 }, { 2, 0 },
+                  { 0, 6 }, { 6, 4 }, { 4, 5 } } },
+    { 4, -1, 0, { 0 }, { { 0 } } },
+};
+
+/*---------------------------------------------------------------------------*/
+
+struct snth_event
+{
+    int      time;              /* Absolute frame time                     */
+    uint16_t off;               /* Offset of the message in the arena      */
+    uint16_t len;               /* Length of the message                   */
+};
+
+/*---------------------------------------------------------------------------*/
+
 struct snth_frame
 {
     float L;
@@ -216,20 +400,185 @@ static float  freq_tab_d[MAXPATCH];
 static uint16_t curr_note = 0;
 static uint8_t  curr_chan = 0;
 static int      curr_time = 0;
+static int      note_time = 0;
 
 static float modula [MAXFRAME];
-static float outputL[MAXFRAME];
-static float outputR[MAXFRAME];
+static float outputL[MAXBUS][MAXFRAME];
+static float outputR[MAXBUS][MAXFRAME];
+static int   outputM[MAXBUS];
+static int   outputV[MAXBUS];
+
+static uint8_t route[MAXCHANNEL];
+static float   sendR[MAXFRAME];
+static float   sendC[MAXFRAME];
+
+static struct snth_reverb reverb;
+static struct snth_chorus chorus;
+static struct snth_limiter limiter;
+
+static uint8_t smooth_time = DEF_SMOOTH_TIME;
+static float   smooth_t    = 0;
+
+static int   layout   = SNTH_LAYOUT_STEREO;
+static int   surround = 0;
+static float outputS[MAXSPEAKER][MAXFRAME];
+static float spatial[MAXCHANNEL][MAXSPEAKER];
+static float bedL[MAXSPEAKER];
+static float bedR[MAXSPEAKER];
 
 static struct snth_channel channel[MAXCHANNEL];
-static struct snth_patch   patch  [MAXPATCH];
 static struct snth_note    note   [MAXNOTE];
 
+/* Setters write patches to the edit bank, which rendering never reads.      */
+/* Threads take turns at it.  The audio thread never waits for its turn, but */
+/* puts off whatever wanted it until a later chunk.                          */
+
+static struct snth_patch edit[MAXPATCH];
+
+static volatile int edit_lock  = 0;
+static volatile int edit_want  = 0;
+static __thread int edit_held  = 0;
+static int          edit_depth = 0;
+static __thread int edit_patch = -1;
+static uint8_t      edit_dirty[MAXPATCH];
+
+/* Patches are published as immutable versions drawn from a pool.  A table   */
+/* maps each patch to its current version, and a commit publishes a whole    */
+/* new table with a single pointer store.  Each voice holds a reference to   */
+/* the version it started with.  A replaced version returns to the pool      */
+/* once no voice refers to it and the renderer has since finished a block,   */
+/* or is idle.  Only the audio thread changes references.  The pool holds    */
+/* every current version, one retired version per voice, and a whole new    */
+/* bank.                                                                     */
+
+static struct snth_patch  patch_pool [MAXVERSION];
+static volatile uint16_t  patch_refs [MAXVERSION];
+static uint8_t            patch_used [MAXVERSION];
+static uint8_t            patch_id   [MAXVERSION];
+static unsigned           patch_gone [MAXVERSION];
+static uint16_t           patch_table[2][MAXPATCH];
+static uint16_t *volatile patch_curr = patch_table[0];
+static int                patch_follow = 0;
+
+static uint16_t *volatile render_table = NULL;
+static volatile unsigned  render_epoch = 0;
+static volatile int       render_busy  = 0;
+static __thread int       render_self  = 0;
+
+/* Writers bracket each change to channel, effect, or published patch state  */
+/* between two counts.  A reader's copy is consistent if no change began     */
+/* after the last one to end before it.                                      */
+
+static volatile unsigned  state_begin = 0;
+static volatile unsigned  state_end   = 0;
+
+#define VERSION_FREE 0
+#define VERSION_CURR 1
+#define VERSION_GONE 2
+
 /*---------------------------------------------------------------------------*/
 
 static void snth_set_tone_env_cache(uint8_t, uint8_t, uint8_t);
 static void snth_set_tone_lfo_cache(uint8_t, uint8_t, uint8_t);
 
+static void snth_put_patches(void);
+static void snth_get_shared(void);
+
+static uint8_t snth_curr_patch(void)
+{
+    /* Setters act on the current channel's patch unless a bulk set names */
+    /* another.                                                            */
+
+    return (edit_patch < 0) ? channel[curr_chan].patch : (uint8_t) edit_patch;
+}
+
+static int snth_try_edit(void)
+{
+    int i;
+
+    /* Take the edit bank, failing rather than waiting during rendering.  */
+    /* A renderer that failed is briefly given the next turn, so that a   */
+    /* busy editor cannot hold off its events indefinitely.               */
+
+    if (edit_held == 0)
+    {
+        if (!render_self)
+            for (i = 0; edit_want && i < EDIT_WAIT; ++i)
+                sched_yield();
+
+        while (__sync_lock_test_and_set(&edit_lock, 1))
+        {
+            if (render_self)
+            {
+                edit_want = 1;
+                return 0;
+            }
+            sched_yield();
+        }
+
+        if (render_self)
+            edit_want = 0;
+    }
+
+    edit_held++;
+    return 1;
+}
+
+static int snth_take_edit(void)
+{
+    /* During rendering, only an event or shared table already holding */
+    /* the edit bank may edit, as any other edit would be lost.         */
+
+    assert(edit_held || !render_self);
+
+    return snth_try_edit();
+}
+
+static void snth_give_edit(void)
+{
+    if (--edit_held == 0)
+        __sync_lock_release(&edit_lock);
+}
+
+static void snth_enter_render(void)
+{
+    /* The renderer reads a single patch table throughout each block. */
+
+    render_self  = 1;
+    render_busy  = 1;
+    __sync_synchronize();
+    render_table = patch_curr;
+    __sync_synchronize();
+}
+
+static const uint16_t *snth_curr_table(void)
+{
+    return render_self ? render_table : patch_curr;
+}
+
+static void snth_leave_render(void)
+{
+    /* Advancing the epoch releases every version seen during the block. */
+
+    __sync_synchronize();
+    render_epoch++;
+    __sync_synchronize();
+    render_busy = 0;
+    render_self = 0;
+}
+
+static void snth_enter_state(void)
+{
+    __sync_fetch_and_add(&state_begin, 1);
+    __sync_synchronize();
+}
+
+static void snth_leave_state(void)
+{
+    __sync_synchronize();
+    __sync_fetch_and_add(&state_end, 1);
+}
+
 /*---------------------------------------------------------------------------*/
 /* Convert from 7-bit MIDI values to [0,1], [-1,+1], or frame time.          */
 
@@ -253,6 +602,23 @@ static void vec_set(float *v, int n, float k)
         dst[i] = val;
 }
 
+static void vec_ramp(float *v, int n, float a, float z)
+{
+    const float d = (z - a) / n;
+
+    __m128 *dst = (__m128 *) v;
+    __m128  val = _mm_set_ps(a + 4 * d, a + 3 * d, a + 2 * d, a + d);
+    __m128  inc = _mm_set1_ps(4 * d);
+
+    int i;
+
+    for (i = 0; i < (n >> 2); ++i)
+    {
+        dst[i] = val;
+        val    = _mm_add_ps(val, inc);
+    }
+}
+
 static void vec_acc(float *v, const float *w, int n, float k)
 {
           __m128 *dst =       (__m128 *) v;
@@ -325,6 +691,38 @@ static void vec_mod(float *v, const float *w, int n, float k)
     }
 }
 
+static void vec_pan(float *l, float *r, const float *w,
+                    const float *gl, const float *gr, int n)
+{
+          __m128 *dstL  =       (__m128 *) l;
+          __m128 *dstR  =       (__m128 *) r;
+    const __m128 *src   = (const __m128 *) w;
+    const __m128 *gainL = (const __m128 *) gl;
+    const __m128 *gainR = (const __m128 *) gr;
+
+    int i;
+
+    for (i = (n >> 2) - 1; i >= 0; --i)
+    {
+        dstL[i] = _mm_add_ps(dstL[i], _mm_mul_ps(src[i], gainL[i]));
+        dstR[i] = _mm_add_ps(dstR[i], _mm_mul_ps(src[i], gainR[i]));
+    }
+}
+
+static void vec_interleave(float *v, const float *u, const float *w, int n)
+{
+    const __m128 *src1 = (const __m128 *) u;
+    const __m128 *src2 = (const __m128 *) w;
+
+    int i;
+
+    for (i = (n >> 2) - 1; i >= 0; --i)
+    {
+        _mm_storeu_ps(v + 8 * i + 0, _mm_unpacklo_ps(src1[i], src2[i]));
+        _mm_storeu_ps(v + 8 * i + 4, _mm_unpackhi_ps(src1[i], src2[i]));
+    }
+}
+
 static void vec_clamp(float *v, const float *w, int n, float k0, float k1)
 {
           __m128 *dst =       (__m128 *) v;
@@ -353,6 +751,16 @@ static void vec_set(float *v, int n, float k)
         v[i] = k;
 }
 
+static void vec_ramp(float *v, int n, float a, float z)
+{
+    const float d = (z - a) / n;
+
+    int i;
+
+    for (i = 0; i < n; ++i)
+        v[i] = a + (i + 1) * d;
+}
+
 static void vec_acc(float *v, const float *w, int n, float k)
 {
     int i;
@@ -369,6 +777,29 @@ static void vec_mod(float *v, const float *w, int n, float k)
         v[i] *= w[i] * k;
 }
 
+static void vec_pan(float *l, float *r, const float *w,
+                    const float *gl, const float *gr, int n)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+    {
+        l[i] += w[i] * gl[i];
+        r[i] += w[i] * gr[i];
+    }
+}
+
+static void vec_interleave(float *v, const float *u, const float *w, int n)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+    {
+        v[2 * i + 0] = u[i];
+        v[2 * i + 1] = w[i];
+    }
+}
+
 static void vec_clamp(float *v, const float *w, int n, float a, float z)
 {
     int i;
@@ -1128,117 +1559,395 @@ static void snth_get_phase(float *phase, const float *freq, int n, int m,
     *osc_phase = k;
 }
 */
-/*
-static float snth_get_pan(float pan)
-{
-    if (pan <= -1) return 0;
-    if (pan >=  1) return 1;
 
-    return sine_table[F2I((pan + 1) * MAXSINE / 2)];
-}
-*/
+/* Constant-power panning takes the gains from the first quarter period of   */
+/* the sine table: right follows sin, left follows cos, which is the same    */
+/* table offset by one quarter.  Position runs from -1 (left) to +1 (right). */
 
-/*---------------------------------------------------------------------------*/
+#define PAN_K ((float) MAXSINE / 8)
 
-static int snth_get_osc(struct snth_osc  *O,
-                        const struct snth_tone *T,
-                        int n, int p, int l, int mode0, int mode1)
+static float snth_get_sine(float u)
 {
-    const struct snth_env *E = T->env;
-    const struct snth_lfo *L = T->lfo;
+    int i = (int) u;
 
-    /* Working buffers */
+    return sine_tab_k[i] + sine_tab_d[i] * (u - i);
+}
 
-    static float env_level[3][MAXFRAME];
-    static float lfo_param[2][MAXFRAME];
+static void snth_get_gain(float *gL, float *gR, float pan, float k)
+{
+    float u;
 
-    static float pitch[MAXFRAME];
-    static float phase[MAXFRAME];
-    static float level[MAXFRAME];
-    static float freq [MAXFRAME];
-    static float wave [MAXFRAME];
-    static float cut  [MAXFRAME];
+    if      (pan < -1) pan = -1;
+    else if (pan > +1) pan = +1;
 
-    /* Tone parameters */
+    u = (pan + 1) * PAN_K;
 
-    const float note = p + T->pitch_coarse - 64 + TO_11(T->pitch_fine);
-    const float time = (float) O->time;
+    *gL = k * snth_get_sine(u + MAXSINE / 4);
+    *gR = k * snth_get_sine(u);
+}
 
-    /* Evaluate the envelopes. */
+static void snth_get_pan(float *gainL, float *gainR,
+                         const float *pan, int n, float k)
+{
+    int i;
 
-    if (T->flags & FL_ENV0)
-        snth_get_env(env_level[0], n, E[0].am, E[0].ab, E[0].dm, E[0].db,
-                     E[0].sb, O->rm[0], O->rb[0], time);
-    if (T->flags & FL_ENV1)
-        snth_get_env(env_level[1], n, E[1].am, E[1].ab, E[1].dm, E[1].db,
-                     E[1].sb, O->rm[1], O->rb[1], time);
-    if (T->flags & FL_ENV2)
-        snth_get_env(env_level[2], n, E[2].am, E[2].ab, E[2].dm, E[2].db,
-                     E[2].sb, O->rm[2], O->rb[2], time);
+    /* SSE is not well-suited for table lookups. */
 
-    /* Evaluate the LFOs. */
+    for (i = 0; i < n; i += 4)
+    {
+        const float *src = pan + i;
 
-    if (T->flags & FL_LFO0)
-        snth_get_lfo(lfo_param[0], n,
-                     L[0].wave, L[0].freq, L[0].dm, time, O->lfo_phase + 0);
-    if (T->flags & FL_LFO1)
-        snth_get_lfo(lfo_param[1], n,
-                     L[1].wave, L[1].freq, L[1].dm, time, O->lfo_phase + 1);
+        /* Map pan positions onto quarter-period sine table coordinates. */
 
-    /* Evaluate the frequency and phase. */
+        float u0 = (src[0] + 1) * PAN_K;
+        float u1 = (src[1] + 1) * PAN_K;
+        float u2 = (src[2] + 1) * PAN_K;
+        float u3 = (src[3] + 1) * PAN_K;
 
-    if (T->flags & FL_PITCH)
-    {
-        vec_set(pitch, n, note);
+        /* Look up the left and right gains, folding in the given level. */
 
-        if ((T->flags & FL_LFO0) && (L[0].pitch   != DEF_LFO_PITCH))
-            vec_acc(pitch, lfo_param[0], n, L[0].pitch   - 64);
-        if ((T->flags & FL_LFO1) && (L[1].pitch   != DEF_LFO_PITCH))
-            vec_acc(pitch, lfo_param[1], n, L[1].pitch   - 64);
-        if ((T->flags & FL_ENV1) && (T->pitch_env != DEF_TONE_PITCH_ENV))
-            vec_acc(pitch, env_level[1], n, T->pitch_env - 64);
+        gainL[i + 0] = k * snth_get_sine(u0 + MAXSINE / 4);
+        gainL[i + 1] = k * snth_get_sine(u1 + MAXSINE / 4);
+        gainL[i + 2] = k * snth_get_sine(u2 + MAXSINE / 4);
+        gainL[i + 3] = k * snth_get_sine(u3 + MAXSINE / 4);
 
-        vec_clamp(pitch, pitch, n, 0, 127);
+        gainR[i + 0] = k * snth_get_sine(u0);
+        gainR[i + 1] = k * snth_get_sine(u1);
+        gainR[i + 2] = k * snth_get_sine(u2);
+        gainR[i + 3] = k * snth_get_sine(u3);
+    }
+}
 
-        snth_get_freq(freq, pitch, n);
+/*---------------------------------------------------------------------------*/
 
-        if (mode0 == SNTH_MODE_MOD)
-            vec_fm(freq, freq, modula, n);
+/* Each bus begins each block as a single mono signal in outputL.  The first */
+/* voice with unequal left and right gains splits it into a stereo pair.     */
 
-        snth_get_phase_variable(phase, freq, n, 1.0f / rate, &O->osc_phase);
-    }
-    else
+static void snth_split_output(int b, int n)
+{
+    if (outputM[b])
     {
-        float freq;
+        memcpy(outputR[b], outputL[b], n * sizeof (float));
+        outputM[b] = 0;
+    }
+}
 
-        if      (note > 127) freq = 12543.8539514160f;
-        else if (note <   0) freq =     8.1757989156f;
-        else                 freq = snth_freq(note);
+/*---------------------------------------------------------------------------*/
 
-        snth_get_phase_constant(phase, freq, n, 1.0f / rate, &O->osc_phase);
-    }
+/* In surround layouts each channel is placed by azimuth and elevation.      */
+/* Speaker gains are found once per block for four channels at a time, one   */
+/* channel per lane, by pairwise amplitude panning between the two speakers  */
+/* that bracket the azimuth.  Elevation blends toward all speakers equally.  */
+/* Ambisonic layouts encode the direction directly.                          */
 
-    /* Evaluate the waveform. */
+static __m128 vec_wrap4(__m128 u)
+{
+    const __m128 v1 = _mm_set1_ps(1.0f);
 
-    snth_fix_phase(phase, n);
-    snth_get_wave(wave, phase, n, T->wave);
+    int i;
 
-    if (mode0 == SNTH_MODE_RNG)
-        vec_mul(wave, wave, modula, n);
+    /* Wrap angles in -4 to +4 turns onto 0 to 1. */
 
-    /* Apply the filter. */
+    u = _mm_add_ps(u, _mm_set1_ps(4.0f));
 
-    if (T->flags & FL_FILTER)
-    {
-        const float res = TO_01(T->filter_res);
+    for (i = 0; i < 8; ++i)
+        u = _mm_sub_ps(u, _mm_and_ps(_mm_cmpge_ps(u, v1), v1));
 
-        vec_set(cut, n, TO_01(T->filter_cut) +
-                        TO_11(T->filter_key) * TO_01(l));
+    return u;
+}
 
-        if ((T->flags & FL_LFO0) && (L[0].filter   != DEF_LFO_FILTER))
-            vec_acc(cut, lfo_param[0], n, TO_11(T->lfo[0].filter));
-        if ((T->flags & FL_LFO1) && (L[1].filter   != DEF_LFO_FILTER))
-            vec_acc(cut, lfo_param[1], n, TO_11(T->lfo[1].filter));
+static __m128 vec_cos4(__m128 u)
+{
+    __m128 p = vec_wrap4(_mm_add_ps(u, _mm_set1_ps(0.75f)));
+    __m128 c;
+
+    /* The sine wave generator gives -sin(2 pi p), so shift it to a cosine. */
+
+    get_sin_wave(&c, &p, 4);
+
+    return c;
+}
+
+static void snth_get_spatial4(__m128 g[MAXSPEAKER], __m128 az, __m128 el)
+{
+    const struct snth_layout *Y = layouts + layout;
+
+    const __m128 v0 = _mm_setzero_ps();
+    const __m128 v1 = _mm_set1_ps(1.0f);
+    const __m128 q  = _mm_set1_ps(0.25f);
+
+    __m128 ce = vec_cos4(el);
+    __m128 ga;
+    __m128 gb;
+    __m128 m;
+    __m128 t;
+    __m128 r;
+
+    int i;
+    int a;
+    int b;
+
+    for (i = 0; i < MAXSPEAKER; ++i)
+        g[i] = v0;
+
+    /* First-order ambisonics: W = 1, Y = sin az cos el, Z = sin el, and    */
+    /* X = cos az cos el.                                                   */
+
+    if (layout == SNTH_LAYOUT_FOA)
+    {
+        g[0] = v1;
+        g[1] = _mm_mul_ps(vec_cos4(_mm_sub_ps(az, q)), ce);
+        g[2] =            vec_cos4(_mm_sub_ps(el, q));
+        g[3] = _mm_mul_ps(vec_cos4(az), ce);
+        return;
+    }
+
+    /* Pan between each pair of adjacent speakers, masked to the lanes      */
+    /* whose azimuth falls within the pair.                                 */
+
+    for (i = 0; i < Y->m; ++i)
+    {
+        const __m128 s = _mm_set1_ps(FRAC(Y->az[Y->pair[i][1]] -
+                                          Y->az[Y->pair[i][0]] + 1.0f));
+        a = Y->pair[i][0];
+        b = Y->pair[i][1];
+
+        t  = vec_wrap4(_mm_sub_ps(az, _mm_set1_ps(Y->az[a])));
+        m  = _mm_cmplt_ps(t, s);
+
+        ga = vec_cos4(_mm_sub_ps(_mm_sub_ps(s, t), q));
+        gb = vec_cos4(_mm_sub_ps(t, q));
+
+        r  = _mm_add_ps(_mm_mul_ps(ga, ga), _mm_mul_ps(gb, gb));
+        r  = _mm_div_ps(v1, _mm_sqrt_ps(_mm_max_ps(r, _mm_set1_ps(1e-12f))));
+
+        g[a] = _mm_add_ps(g[a], _mm_and_ps(m, _mm_mul_ps(ga, r)));
+        g[b] = _mm_add_ps(g[b], _mm_and_ps(m, _mm_mul_ps(gb, r)));
+    }
+
+    /* Blend toward all speakers with elevation, and restore unit power. */
+
+    t = _mm_sub_ps(v1, ce);
+    r = v0;
+
+    for (i = 0; i < Y->n; ++i)
+        if (i != Y->lfe)
+        {
+            g[i] = _mm_add_ps(_mm_mul_ps(g[i], ce), t);
+            r    = _mm_add_ps(r, _mm_mul_ps(g[i], g[i]));
+        }
+
+    r = _mm_div_ps(v1, _mm_sqrt_ps(r));
+
+    for (i = 0; i < Y->n; ++i)
+        g[i] = _mm_mul_ps(g[i], r);
+}
+
+static float snth_get_spatial_pan(const struct snth_channel *C)
+{
+    const float p = TO_11(C->pan) + C->mp;
+
+    return (p < -1.0f) ? -1.0f : ((p > 1.0f) ? 1.0f : p);
+}
+
+static void snth_set_spatial(void)
+{
+    __m128 g[MAXSPEAKER];
+    float  t[4];
+    int    i;
+    int    j;
+    int    k;
+
+    /* Find the speaker gains of all channels, four at a time. */
+
+    for (i = 0; i < MAXCHANNEL; i += 4)
+    {
+        const struct snth_channel *C = channel + i;
+
+        /* Channel pan and the pan controller swing the azimuth across the */
+        /* front 60 degrees.  Azimuth runs to the left and pan to the      */
+        /* right.                                                          */
+
+        __m128 az = _mm_set_ps(
+            TO_11(C[3].azimuth) * 0.5f - snth_get_spatial_pan(C + 3) / 12.0f,
+            TO_11(C[2].azimuth) * 0.5f - snth_get_spatial_pan(C + 2) / 12.0f,
+            TO_11(C[1].azimuth) * 0.5f - snth_get_spatial_pan(C + 1) / 12.0f,
+            TO_11(C[0].azimuth) * 0.5f - snth_get_spatial_pan(C + 0) / 12.0f);
+        __m128 el = _mm_set_ps(
+            TO_11(C[3].elevation) * 0.25f,
+            TO_11(C[2].elevation) * 0.25f,
+            TO_11(C[1].elevation) * 0.25f,
+            TO_11(C[0].elevation) * 0.25f);
+
+        snth_get_spatial4(g, az, el);
+
+        for (j = 0; j < MAXSPEAKER; ++j)
+        {
+            _mm_storeu_ps(t, g[j]);
+
+            for (k = 0; k < 4; ++k)
+                spatial[i + k][j] = t[k];
+        }
+    }
+
+    /* The stereo effect returns sound from the front left and right. */
+
+    snth_get_spatial4(g, _mm_set_ps(0, 0, -1 / 12.0f, +1 / 12.0f),
+                         _mm_setzero_ps());
+
+    for (j = 0; j < MAXSPEAKER; ++j)
+    {
+        _mm_storeu_ps(t, g[j]);
+
+        bedL[j] = t[0];
+        bedR[j] = t[1];
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Continuous parameters glide toward their targets on a one-pole curve,   */
+/* stepped once per block and ramped linearly across it.                    */
+
+static int snth_get_ramp(float *v, int n, float *s, float t, float a)
+{
+    const float s0 = (a < 1.0f) ? *s : t;
+          float s1 = s0 + a * (t - s0);
+
+    if (fabsf(t - s1) < 1e-4f)
+        s1 = t;
+
+    *s = s1;
+
+    if (s0 == s1)
+    {
+        vec_set(v, n, s1);
+        return 0;
+    }
+    else
+    {
+        vec_ramp(v, n, s0, s1);
+        return 1;
+    }
+}
+
+static int snth_get_osc(struct snth_osc  *O,
+                        const struct snth_tone *T,
+                        const struct snth_channel *C, int b, int o, int z,
+                        int n, int p, int l, float v, int mode0, int mode1)
+{
+    const struct snth_env *E = T->env;
+    const struct snth_lfo *L = T->lfo;
+
+    /* Working buffers */
+
+    static float env_level[3][MAXFRAME];
+    static float lfo_param[2][MAXFRAME];
+
+    static float pitch[MAXFRAME];
+    static float phase[MAXFRAME];
+    static float level[MAXFRAME];
+    static float freq [MAXFRAME];
+    static float wave [MAXFRAME];
+    static float cut  [MAXFRAME];
+    static float pan  [MAXFRAME];
+    static float gainL[MAXFRAME];
+    static float gainR[MAXFRAME];
+    static float gainK[MAXFRAME];
+
+    /* Tone parameters */
+
+    const float note = p + T->pitch_coarse - 64 + TO_11(T->pitch_fine)
+                         + C->mb;
+    const float time = (float) O->time;
+
+    /* Vibrato deepens LFO 0 pitch modulation, where LFO 0 is in use. */
+
+    const int vib = (T->flags & FL_LFO0) && (v > 0);
+
+    /* Smoothing begins after the first block. */
+
+    const float a = O->ramp ? (float) n / (smooth_t + n) : 1.0f;
+
+    O->ramp = 1;
+
+    /* Evaluate the envelopes. */
+
+    if (T->flags & FL_ENV0)
+        snth_get_env(env_level[0], n, E[0].am, E[0].ab, E[0].dm, E[0].db,
+                     E[0].sb, O->rm[0], O->rb[0], time);
+    if (T->flags & FL_ENV1)
+        snth_get_env(env_level[1], n, E[1].am, E[1].ab, E[1].dm, E[1].db,
+                     E[1].sb, O->rm[1], O->rb[1], time);
+    if (T->flags & FL_ENV2)
+        snth_get_env(env_level[2], n, E[2].am, E[2].ab, E[2].dm, E[2].db,
+                     E[2].sb, O->rm[2], O->rb[2], time);
+
+    /* Evaluate the LFOs. */
+
+    if (T->flags & FL_LFO0)
+        snth_get_lfo(lfo_param[0], n,
+                     L[0].wave, L[0].freq, L[0].dm, time, O->lfo_phase + 0);
+    if (T->flags & FL_LFO1)
+        snth_get_lfo(lfo_param[1], n,
+                     L[1].wave, L[1].freq, L[1].dm, time, O->lfo_phase + 1);
+
+    /* Evaluate the frequency and phase. */
+
+    if ((T->flags & FL_PITCH) || vib)
+    {
+        vec_set(pitch, n, note);
+
+        if ((T->flags & FL_LFO0) && (L[0].pitch   != DEF_LFO_PITCH))
+            vec_acc(pitch, lfo_param[0], n, L[0].pitch   - 64);
+        if ((T->flags & FL_LFO1) && (L[1].pitch   != DEF_LFO_PITCH))
+            vec_acc(pitch, lfo_param[1], n, L[1].pitch   - 64);
+        if ((T->flags & FL_ENV1) && (T->pitch_env != DEF_TONE_PITCH_ENV))
+            vec_acc(pitch, env_level[1], n, T->pitch_env - 64);
+        if (vib)
+            vec_acc(pitch, lfo_param[0], n, v);
+
+        vec_clamp(pitch, pitch, n, 0, 127);
+
+        snth_get_freq(freq, pitch, n);
+
+        if (mode0 == SNTH_MODE_MOD)
+            vec_fm(freq, freq, modula + o, n);
+
+        snth_get_phase_variable(phase, freq, n, 1.0f / rate, &O->osc_phase);
+    }
+    else
+    {
+        float freq;
+
+        if      (note > 127) freq = 12543.8539514160f;
+        else if (note <   0) freq =     8.1757989156f;
+        else                 freq = snth_freq(note);
+
+        snth_get_phase_constant(phase, freq, n, 1.0f / rate, &O->osc_phase);
+    }
+
+    /* Evaluate the waveform. */
+
+    snth_fix_phase(phase, n);
+    snth_get_wave(wave, phase, n, T->wave);
+
+    if (mode0 == SNTH_MODE_RNG)
+        vec_mul(wave, wave, modula + o, n);
+
+    /* Apply the filter. */
+
+    if (T->flags & FL_FILTER)
+    {
+        const float res = TO_01(T->filter_res);
+
+        snth_get_ramp(cut, n, &O->sc, TO_01(T->filter_cut) +
+                                      TO_11(T->filter_key) * TO_01(l), a);
+
+        if ((T->flags & FL_LFO0) && (L[0].filter   != DEF_LFO_FILTER))
+            vec_acc(cut, lfo_param[0], n, TO_11(T->lfo[0].filter));
+        if ((T->flags & FL_LFO1) && (L[1].filter   != DEF_LFO_FILTER))
+            vec_acc(cut, lfo_param[1], n, TO_11(T->lfo[1].filter));
         if ((T->flags & FL_ENV2) && (T->filter_env != DEF_TONE_FILTER_ENV))
             vec_acc(cut, env_level[2], n, TO_11(T->filter_env));
 
@@ -1249,7 +1958,7 @@ static int snth_get_osc(struct snth_osc  *O,
 
     /* Evaluate the level. */
 
-    vec_set(level, n, TO_01(T->level) * TO_01(l));
+    snth_get_ramp(level, n, &O->sl, TO_01(T->level) * TO_01(l), a);
 
     if ((T->flags & FL_LFO0) && (L[0].level != DEF_LFO_LEVEL))
         vec_acc(level, lfo_param[0], n, TO_11(T->lfo[0].level));
@@ -1258,17 +1967,90 @@ static int snth_get_osc(struct snth_osc  *O,
     if ((T->flags & FL_ENV0))
         vec_mod(level, env_level[0], n, 1);
 
+    /* Silence any lead-in ahead of the oscillator's first frame. */
+
+    if (z)
+        memset(level, 0, z * sizeof (float));
+
     /* Evaluate the final output. */
 
     if (mode1 == SNTH_MODE_MIX)
     {
+        const int rk = snth_get_ramp(gainK, n, &O->sk,
+                                     TO_01(C->level) * C->mk, a);
+        const int rx = snth_get_ramp(pan,   n, &O->sp,
+                                     TO_11(T->pan) + TO_11(C->pan) + C->mp, a);
+
+        const float k = rk ? 1.0f : O->sk;
+        const float x = O->sp;
+
+        outputV[b] = 1;
+
         vec_mul(wave, wave, level, n);
 
-        vec_acc(outputL, wave, n, 1);
-        vec_acc(outputR, wave, n, 1);
+        /* Apply a moving channel level here, and a moving pan as for an    */
+        /* LFO pan.                                                         */
+
+        if (rk)
+            vec_mul(wave, wave, gainK, n);
+
+        /* Place the output among the speakers, or pan it, folding in the   */
+        /* channel level.  Surround placement is per channel, so a channel   */
+        /* bus is left unpanned, to be placed after its inserts and sends.  */
+
+        if (surround && b == MIXBUS)
+        {
+            const float *g = spatial[C - channel];
+            int j;
+
+            for (j = 0; j < layouts[layout].n; ++j)
+                if (g[j] != 0.0f)
+                    vec_acc(outputS[j] + o, wave, n, k * g[j]);
+        }
+        else if (surround)
+        {
+            if (!outputM[b])
+                vec_acc(outputR[b] + o, wave, n, k);
+
+            vec_acc(outputL[b] + o, wave, n, k);
+        }
+        else if ((T->flags & FL_PAN) || rx)
+        {
+            if ((T->flags & FL_LFO0) && (L[0].pan != DEF_LFO_PAN))
+                vec_acc(pan, lfo_param[0], n, TO_11(T->lfo[0].pan));
+            if ((T->flags & FL_LFO1) && (L[1].pan != DEF_LFO_PAN))
+                vec_acc(pan, lfo_param[1], n, TO_11(T->lfo[1].pan));
+
+            vec_clamp(pan, pan, n, -1, 1);
+
+            snth_get_pan(gainL, gainR, pan, n, k);
+            snth_split_output(b, o + n);
+
+            vec_pan(outputL[b] + o, outputR[b] + o, wave, gainL, gainR, n);
+        }
+        else
+        {
+            float gL;
+            float gR;
+
+            snth_get_gain(&gL, &gR, x, k);
+
+            if (outputM[b] && gL == gR)
+                vec_acc(outputL[b] + o, wave, n, gL);
+            else
+            {
+                snth_split_output(b, o + n);
+
+                vec_acc(outputL[b] + o, wave, n, gL);
+                vec_acc(outputR[b] + o, wave, n, gR);
+            }
+        }
     }
     else
-        vec_mul(modula, wave, level, n);
+    {
+        memset(modula, 0, o * sizeof (float));
+        vec_mul(modula + o, wave, level, n);
+    }
 
     O->time += n;
 
@@ -1284,10 +2066,56 @@ static int snth_get_osc(struct snth_osc  *O,
     return O->state;
 }
 
+static int snth_get_tone(struct snth_note *N,
+                         const struct snth_tone *T,
+                         const struct snth_channel *C, int b, int k, int d,
+                         int n, int mode0, int mode1)
+{
+    /* Find the frame of this block at which the tone begins. */
+
+    const int s = N->start + d - curr_time;
+    const int o = (s > 0) ? (s & ~3) : 0;
+
+    /* Skip the tone entirely until its first block, and skip the whole     */
+    /* vectors of that block before its first frame.                        */
+
+    if (s >= n)
+        return 0;
+
+    N->osc[k].time = o - s;
+
+    return snth_get_osc(N->osc + k, T + k, C, b, o, (s > o) ? s - o : 0,
+                        n - o, N->pitch, N->level, C->mv + TO_01(N->press),
+                        mode0, mode1);
+}
+
+static const struct snth_tone *snth_note_tone(const struct snth_note *N)
+{
+    /* A voice plays the version it started with, or the latest one. */
+
+    if (patch_follow)
+        return patch_pool[snth_curr_table()[patch_id[N->version]]].tone;
+    else
+        return patch_pool[N->version].tone;
+}
+
+static void snth_note_free(struct snth_note *N)
+{
+    /* Kill a note and release its patch version. */
+
+    if (N->version != NO_VERSION)
+        patch_refs[N->version]--;
+
+    N->version = NO_VERSION;
+    N->level   = 0;
+}
+
 static int snth_get_note(struct snth_note *N, int n)
 {
     const struct snth_channel *C = channel + N->chan;
-    const struct snth_tone    *T = patch[C->patch].tone;
+    const struct snth_tone    *T = snth_note_tone(N);
+
+    const int b  = route[N->chan];
 
     const int e0 = N->osc[0].state;
     const int e1 = N->osc[1].state;
@@ -1307,432 +2135,2766 @@ static int snth_get_note(struct snth_note *N, int n)
 
     int c = 0;
 
-    if (m0 && e0 && curr_time - N->start >= d0)
-        c += snth_get_osc(N->osc + 0, T + 0, n, N->pitch, N->level, mx, m0);
-    if (m1 && e1 && curr_time - N->start >= d1)
-        c += snth_get_osc(N->osc + 1, T + 1, n, N->pitch, N->level, m0, m1);
-    if (m2 && e2 && curr_time - N->start >= d2)
-        c += snth_get_osc(N->osc + 2, T + 2, n, N->pitch, N->level, m1, m2);
-    if (m3 && e3 && curr_time - N->start >= d3)
-        c += snth_get_osc(N->osc + 3, T + 3, n, N->pitch, N->level, m2, m3);
+    if (m0 && e0) c += snth_get_tone(N, T, C, b, 0, d0, n, mx, m0);
+    if (m1 && e1) c += snth_get_tone(N, T, C, b, 1, d1, n, m0, m1);
+    if (m2 && e2) c += snth_get_tone(N, T, C, b, 2, d2, n, m1, m2);
+    if (m3 && e3) c += snth_get_tone(N, T, C, b, 3, d3, n, m2, m3);
 
     /* If none of the oscillators are sounding, kill the note. */
 
     if (e0 == 0 && e1 == 0 && e2 == 0 && e3 == 0)
-        N->level = 0;
+        snth_note_free(N);
 
     return c;
 }
 
-static int snth_get_buffer(int n)
+/*---------------------------------------------------------------------------*/
+/* Insert effects                                                            */
+
+/* Inserts run on channel buses four at a time, one channel per lane of an   */
+/* SSE vector.  Each four-by-four block of samples is transposed so that a   */
+/* vector holds one instant of four channels, run through the biquad EQ      */
+/* cascade and the waveshaper serially, and transposed back.                 */
+
+static void snth_get_insert4(float *bus[4], int s, const int c[4], int n)
 {
-    int c = 0;
-    int i;
+    static const struct snth_channel none;
+    static float                     junk[MAXFRAME];
 
-    /* Initialize the working audio buffer. */
+    __m128 b0[MAXBAND], b1[MAXBAND], b2[MAXBAND], a1[MAXBAND], a2[MAXBAND];
+    __m128 z1[MAXBAND], z2[MAXBAND];
 
-    memset(outputL, 0, n * sizeof (float));
-    memset(outputR, 0, n * sizeof (float));
+    const __m128 sgn = _mm_set1_ps(-0.0f);
+    const __m128 v1  = _mm_set1_ps(1.0f);
 
-    /* Iterate over all notes, processing the active ones. */
+    const struct snth_channel *C[4];
 
-    for (i = 0; i < MAXNOTE; ++i)
-        if (note[i].level)
-            c += snth_get_note(note + i, n);
+    __m128 dk;
+    __m128 x[4];
+    __m128 y;
+    __m128 u;
 
-    curr_time += n;
+    float *src[4];
+    float *dst[4];
+    int i;
+    int j;
+    int k;
 
-    return c;
-}
+    /* Unused lanes filter silence with all-zero coefficients. */
 
-int snth_get_output(void *buffer, size_t frames)
-{
-    assert((frames % 4) == 0);
+    for (j = 0; j < 4; ++j)
+        if (c[j] < 0)
+        {
+            C  [j] = &none;
+            src[j] = junk;
+            dst[j] = junk;
+        }
+        else
+        {
+            C  [j] = channel + c[j];
+            src[j] = bus[j];
+            dst[j] = bus[j];
+        }
 
-    int16_t *L = (int16_t *) buffer + 0;
-    int16_t *R = (int16_t *) buffer + 1;
+    /* Gather the coefficients and state of each channel into its lane. */
 
-    size_t count;
-    int c = 0;
-    int m = 0;
+    for (k = 0; k < MAXBAND; ++k)
+    {
+        b0[k] = _mm_set_ps(C[3]->eq[k][0], C[2]->eq[k][0],
+                           C[1]->eq[k][0], C[0]->eq[k][0]);
+        b1[k] = _mm_set_ps(C[3]->eq[k][1], C[2]->eq[k][1],
+                           C[1]->eq[k][1], C[0]->eq[k][1]);
+        b2[k] = _mm_set_ps(C[3]->eq[k][2], C[2]->eq[k][2],
+                           C[1]->eq[k][2], C[0]->eq[k][2]);
+        a1[k] = _mm_set_ps(C[3]->eq[k][3], C[2]->eq[k][3],
+                           C[1]->eq[k][3], C[0]->eq[k][3]);
+        a2[k] = _mm_set_ps(C[3]->eq[k][4], C[2]->eq[k][4],
+                           C[1]->eq[k][4], C[0]->eq[k][4]);
+
+        z1[k] = _mm_set_ps(C[3]->eqz[s][k][0], C[2]->eqz[s][k][0],
+                           C[1]->eqz[s][k][0], C[0]->eqz[s][k][0]);
+        z2[k] = _mm_set_ps(C[3]->eqz[s][k][1], C[2]->eqz[s][k][1],
+                           C[1]->eqz[s][k][1], C[0]->eqz[s][k][1]);
+    }
 
-    /* Continue processing audio until the given buffer is full. */
+    dk = _mm_set_ps(C[3]->dk, C[2]->dk, C[1]->dk, C[0]->dk);
 
-    for (count = 0; count < frames; count += MAXFRAME)
+    for (i = 0; i < n; i += 4)
     {
-        size_t i, n = ((frames - count) < MAXFRAME ?
-                       (frames - count) : MAXFRAME);
+        for (j = 0; j < 4; ++j)
+            x[j] = _mm_load_ps(src[j] + i);
 
-        /* Process a chunk of audio. */
+        _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
 
-        c = snth_get_buffer((int) n);
+        for (j = 0; j < 4; ++j)
+        {
+            y = x[j];
 
-        if (m < c)
-            m = c;
+            /* Three biquads in transposed direct form II. */
 
-        /* Copy clamped audio to the output buffer. */
+            for (k = 0; k < MAXBAND; ++k)
+            {
+                u     = y;
+                y     = _mm_add_ps(_mm_mul_ps(b0[k], u), z1[k]);
+                z1[k] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1[k], u),
+                                              _mm_mul_ps(a1[k], y)), z2[k]);
+                z2[k] =            _mm_sub_ps(_mm_mul_ps(b2[k], u),
+                                              _mm_mul_ps(a2[k], y));
+            }
 
-        if (c)
-        {
-            vec_clamp(outputL, outputL, n, -1, 1);
-            vec_clamp(outputR, outputR, n, -1, 1);
-        }
+            /* Waveshaper: y (1 + k) / (1 + k |y|). */
 
-        for (i = 0; i < n; L += 2, R += 2, ++i)
-        {
-            *L = (int16_t) F2I(outputL[i] * 32767);
-            *R = (int16_t) F2I(outputR[i] * 32767);
+            u    = _mm_add_ps(v1, _mm_mul_ps(dk, _mm_andnot_ps(sgn, y)));
+            x[j] = _mm_div_ps(_mm_mul_ps(y, _mm_add_ps(v1, dk)), u);
         }
-    }
+
+        _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+
+        for (j = 0; j < 4; ++j)
+            _mm_store_ps(dst[j] + i, x[j]);
+    }
+
+    /* Scatter the filter state back to the channels. */
+
+    for (k = 0; k < MAXBAND; ++k)
+    {
+        float t1[4];
+        float t2[4];
+
+        _mm_storeu_ps(t1, z1[k]);
+        _mm_storeu_ps(t2, z2[k]);
+
+        for (j = 0; j < 4; ++j)
+            if (c[j] >= 0)
+            {
+                channel[c[j]].eqz[s][k][0] = t1[j];
+                channel[c[j]].eqz[s][k][1] = t2[j];
+            }
+    }
+}
+
+static void snth_get_insert(int n)
+{
+    float *busL[4];
+    float *busR[4];
+    int    cL[4];
+    int    cR[4];
+    int    m = 0;
+    int    r = 0;
+    int    i;
+    int    j;
+
+    /* Gather channels with active inserts into groups of four. */
+
+    for (i = 0; i < MAXCHANNEL; ++i)
+        if (channel[i].flags)
+        {
+            busL[m] = outputL[i];
+            busR[m] = outputR[i];
+            cL  [m] = i;
+            cR  [m] = outputM[i] ? -1 : i;
+            r      |= !outputM[i];
+
+            /* Process each full group as it completes. */
+
+            if (++m == 4)
+            {
+                snth_get_insert4(busL, 0, cL, n);
+
+                if (r)
+                    snth_get_insert4(busR, 1, cR, n);
+
+                m = 0;
+                r = 0;
+            }
+        }
+
+    if (m)
+    {
+        for (j = m; j < 4; ++j)
+            cL[j] = cR[j] = -1;
+
+        snth_get_insert4(busL, 0, cL, n);
+
+        if (r)
+            snth_get_insert4(busR, 1, cR, n);
+    }
+
+    /* A mono bus keeps the state of its right side in step with its left. */
+
+    for (i = 0; i < MAXCHANNEL; ++i)
+        if (channel[i].flags && outputM[i])
+            memcpy(channel[i].eqz[1], channel[i].eqz[0],
+                   sizeof (channel[i].eqz[0]));
+}
+
+/*---------------------------------------------------------------------------*/
+/* Send effects                                                              */
+
+/* The reverb is a four-line feedback delay network.  The four lines occupy  */
+/* the four lanes of an SSE vector, with a Hadamard matrix mixing feedback   */
+/* between them and a one-pole low-pass in each loop giving HF damping.      */
+
+static void snth_get_reverb(const float *in, int n)
+{
+    struct snth_reverb *V = &reverb;
+
+    const __m128 g  = _mm_set_ps(V->fb[3], V->fb[2], V->fb[1], V->fb[0]);
+    const __m128 s1 = _mm_set_ps(-1.0f, +1.0f, -1.0f, +1.0f);
+    const __m128 s2 = _mm_set_ps(-1.0f, -1.0f, +1.0f, +1.0f);
+    const __m128 a  = _mm_set1_ps(1.0f - V->lp);
+    const __m128 b  = _mm_set1_ps(V->lp);
+    const __m128 h  = _mm_set1_ps(0.5f);
+
+    const float k = TO_01(V->level) * 0.5f;
+
+    __m128 z = _mm_loadu_ps(V->state);
+    __m128 y;
+    __m128 t;
+
+    float out[MAXLINE];
+    int   i;
+    int   j;
+
+    snth_split_output(MIXBUS, n);
+
+    for (i = 0; i < n; ++i)
+    {
+        /* Read the outputs of all four delay lines. */
+
+        y = _mm_set_ps(V->line[3][V->pos[3]],
+                       V->line[2][V->pos[2]],
+                       V->line[1][V->pos[1]],
+                       V->line[0][V->pos[0]]);
+
+        /* Damp them. */
+
+        z = _mm_add_ps(_mm_mul_ps(y, a), _mm_mul_ps(z, b));
+
+        /* Mix them through the Hadamard matrix, scaled by the decay gains. */
+
+        y = _mm_mul_ps(z, g);
+        t = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1));
+        y = _mm_add_ps(t, _mm_mul_ps(y, s1));
+        t = _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 0, 3, 2));
+        y = _mm_add_ps(t, _mm_mul_ps(y, s2));
+        y = _mm_mul_ps(y, h);
+
+        /* Feed the result and the input back into the lines. */
+
+        y = _mm_add_ps(y, _mm_set1_ps(in[i]));
+
+        _mm_storeu_ps(out, y);
+
+        for (j = 0; j < MAXLINE; ++j)
+        {
+            V->line[j][V->pos[j]] = out[j];
+
+            if (++V->pos[j] >= V->len[j])
+                V->pos[j] = 0;
+        }
+
+        /* Sum alternate lines into the left and right returns. */
+
+        _mm_storeu_ps(out, z);
+
+        outputL[MIXBUS][i] += k * (out[0] + out[2]);
+        outputR[MIXBUS][i] += k * (out[1] + out[3]);
+    }
+
+    _mm_storeu_ps(V->state, z);
+}
+
+/* The chorus reads four taps from a single delay line, one tap per lane of  */
+/* an SSE vector.  Each tap's delay is swept by a triangle LFO, with the     */
+/* four LFO phases spread evenly so that the taps never move together.       */
+
+static void snth_get_chorus(const float *in, int n)
+{
+    struct snth_chorus *H = &chorus;
+
+    const __m128 off = _mm_set_ps(0.75f, 0.50f, 0.25f, 0.00f);
+    const __m128 sgn = _mm_set1_ps(-0.0f);
+    const __m128 v1  = _mm_set1_ps(1.0f);
+    const __m128 v2  = _mm_set1_ps(2.0f);
+    const __m128 b   = _mm_set1_ps(H->base);
+    const __m128 w   = _mm_set1_ps(H->width);
+
+    const float k = TO_01(H->level) * 0.5f;
+
+    __m128 p;
+    __m128 t;
+    __m128 f;
+    __m128 y0;
+    __m128 y1;
+
+    float d[MAXTAP];
+    float a[MAXTAP];
+    float c[MAXTAP];
+    float e[MAXTAP];
+    float out[MAXTAP];
+
+    int i;
+    int j;
+
+    snth_split_output(MIXBUS, n);
+
+    for (i = 0; i < n; ++i)
+    {
+        /* Write the input. */
+
+        H->line[H->pos] = in[i];
+
+        /* Evaluate the four tap LFOs, wrapping each phase at one. */
+
+        p = _mm_add_ps(_mm_set1_ps(H->phase), off);
+        t = _mm_and_ps(_mm_cmpge_ps(p, v1), v1);
+        p = _mm_sub_ps(p, t);
+        t = _mm_sub_ps(_mm_mul_ps(p, v2), v1);
+        t = _mm_andnot_ps(sgn, t);
+
+        /* Compute the tap delays in samples. */
+
+        _mm_storeu_ps(d, _mm_add_ps(b, _mm_mul_ps(w, t)));
+
+        /* Read the two samples around each tap from the delay line. */
+
+        for (j = 0; j < MAXTAP; ++j)
+        {
+            float x = (float) H->pos - d[j];
+            int   l;
+
+            /* A tiny negative position wraps to the line's length. */
+
+            if (x < 0) x += MAXCHORUS;
+
+            l    = (int) x;
+            e[j] = x - l;
+            a[j] = H->line[ l      & (MAXCHORUS - 1)];
+            c[j] = H->line[(l + 1) & (MAXCHORUS - 1)];
+        }
+
+        /* Interpolate the taps. */
+
+        y0 = _mm_loadu_ps(a);
+        y1 = _mm_loadu_ps(c);
+        f  = _mm_loadu_ps(e);
+        y0 = _mm_add_ps(y0, _mm_mul_ps(_mm_sub_ps(y1, y0), f));
+
+        _mm_storeu_ps(out, y0);
+
+        /* Sum alternate taps into the left and right returns. */
+
+        outputL[MIXBUS][i] += k * (out[0] + out[2]);
+        outputR[MIXBUS][i] += k * (out[1] + out[3]);
+
+        /* Advance. */
+
+        H->pos = (H->pos + 1) & (MAXCHORUS - 1);
+
+        if ((H->phase += H->freq) >= 1.0f)
+            H->phase -= 1.0f;
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* Master limiter                                                            */
+
+/* The limiter works in units of one SSE vector, four frames.  Each vector's */
+/* peak gives the gain it requires.  The minimum of that over a window of    */
+/* MAXLIMIT vectors, averaged over the next MAXLIMIT - 1, gives a gain that  */
+/* falls linearly to meet each peak as it leaves the delay line, and it can  */
+/* be interpolated across the vector without overshoot.                      */
+
+static float snth_hmin(__m128 x)
+{
+    x = _mm_min_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)));
+    x = _mm_min_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(x);
+}
+
+static float snth_hmax(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)));
+    x = _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(x);
+}
+
+static float snth_hsum(__m128 x)
+{
+    x = _mm_add_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)));
+    x = _mm_add_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(x);
+}
+
+static void snth_get_limiter(float *const bus[], int N, int n)
+{
+    struct snth_limiter *M = &limiter;
+
+    const __m128 ramp = _mm_set_ps(1.00f, 0.75f, 0.50f, 0.25f);
+    const __m128 sgn  = _mm_set1_ps(-0.0f);
+
+    __m128 x[MAXSPEAKER];
+    __m128 t;
+    __m128 g;
+
+    float p;
+    float a;
+    float e;
+    int   i;
+    int   j;
+    int   k;
+
+    for (i = 0; i < n; i += 4)
+    {
+        k = M->pos;
+
+        /* Find the gain required by the peak of the incoming vector. */
+
+        t = _mm_setzero_ps();
+
+        for (j = 0; j < N; ++j)
+        {
+            x[j] = _mm_load_ps(bus[j] + i);
+            t    = _mm_max_ps(t, _mm_andnot_ps(sgn, x[j]));
+        }
+
+        p = snth_hmax(t);
+
+        M->req[k] = (p > M->thr) ? M->thr / p : 1.0f;
+
+        /* Take its minimum over the window and its mean over the delay. */
+
+        t = _mm_loadu_ps(M->req);
+
+        for (j = 4; j < MAXLIMIT; j += 4)
+            t = _mm_min_ps(t, _mm_loadu_ps(M->req + j));
+
+        M->min[k] = snth_hmin(t);
+
+        t = _mm_loadu_ps(M->min);
+
+        for (j = 4; j < MAXLIMIT; j += 4)
+            t = _mm_add_ps(t, _mm_loadu_ps(M->min + j));
+
+        a = (snth_hsum(t) - M->min[(k + 1) & (MAXLIMIT - 1)])
+          / (MAXLIMIT - 1);
+
+        /* Attack along the mean.  Release exponentially. */
+
+        e = M->gain;
+
+        if (a < e)
+            e = a;
+        else
+            e = e + (a - e) * M->rel;
+
+        /* Ramp from the previous gain to this one across the vector. */
+
+        g = _mm_add_ps(_mm_set1_ps(M->gain),
+                       _mm_mul_ps(_mm_set1_ps(e - M->gain), ramp));
+
+        /* Exchange the incoming vectors with those leaving the delay. */
+
+        for (j = 0; j < N; ++j)
+        {
+            float *d = M->delay[j];
+
+            t = _mm_loadu_ps(d + ((k + 1) & (MAXLIMIT - 1)) * 4);
+
+            _mm_storeu_ps(d + k * 4, x[j]);
+            _mm_store_ps(bus[j] + i, _mm_mul_ps(t, g));
+        }
+
+        M->gain = e;
+        M->pos  = (k + 1) & (MAXLIMIT - 1);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void snth_mix_bus(int b, int n)
+{
+    /* Add a channel bus to the mix bus, splitting the mix only if needed. */
+
+    if (outputM[b])
+    {
+        if (outputM[MIXBUS])
+            vec_acc(outputL[MIXBUS], outputL[b], n, 1);
+        else
+        {
+            vec_acc(outputL[MIXBUS], outputL[b], n, 1);
+            vec_acc(outputR[MIXBUS], outputL[b], n, 1);
+        }
+    }
+    else
+    {
+        snth_split_output(MIXBUS, n);
+
+        vec_acc(outputL[MIXBUS], outputL[b], n, 1);
+        vec_acc(outputR[MIXBUS], outputR[b], n, 1);
+    }
+}
+
+static void snth_place_bus(int b, int n)
+{
+    const float *g = spatial[b];
+    int j;
+
+    /* Add a channel bus to the speakers.  Its voices are unpanned, so only */
+    /* a stereo insert leaves it stereo, and the mean of its sides keeps    */
+    /* a centered source at full level.                                     */
+
+    for (j = 0; j < layouts[layout].n; ++j)
+        if (g[j] != 0.0f)
+        {
+            if (outputM[b])
+                vec_acc(outputS[j], outputL[b], n, g[j]);
+            else
+            {
+                vec_acc(outputS[j], outputL[b], n, g[j] * 0.5f);
+                vec_acc(outputS[j], outputR[b], n, g[j] * 0.5f);
+            }
+        }
+}
+
+static void snth_place_return(int n)
+{
+    int j;
+
+    /* Add the stereo effect returns to the speakers. */
+
+    for (j = 0; j < layouts[layout].n; ++j)
+        if (outputM[MIXBUS])
+            vec_acc(outputS[j], outputL[MIXBUS], n, bedL[j] + bedR[j]);
+        else
+        {
+            vec_acc(outputS[j], outputL[MIXBUS], n, bedL[j]);
+            vec_acc(outputS[j], outputR[MIXBUS], n, bedR[j]);
+        }
+}
+
+static void snth_send_bus(float *send, int b, int n, float k)
+{
+    /* Add the mono sum of a channel bus to a send. */
+
+    if (outputM[b])
+        vec_acc(send, outputL[b], n, k);
+    else
+    {
+        vec_acc(send, outputL[b], n, k * 0.5f);
+        vec_acc(send, outputR[b], n, k * 0.5f);
+    }
+}
+
+static void snth_set_route(float *stem[])
+{
+    int i;
+
+    /* Give a bus to each channel with a stem, an insert, or a send. */
+
+    for (i = 0; i < MAXCHANNEL; ++i)
+        if ((stem && stem[i]) || channel[i].flags ||
+            channel[i].reverb || channel[i].chorus)
+            route[i] = (uint8_t) i;
+        else
+            route[i] = MIXBUS;
+}
+
+static void snth_get_return(float *stem[], int n)
+{
+    int s = 0;
+    int z = 0;
+    int w = 0;
+    int i;
+
+    /* Run the channel inserts ahead of the sends and the stems. */
+
+    snth_get_insert(n);
+
+    memset(sendR, 0, n * sizeof (float));
+    memset(sendC, 0, n * sizeof (float));
+
+    /* Feed the sends and mix all channel buses not delivered as stems. */
+
+    for (i = 0; i < MAXCHANNEL; ++i)
+        if (route[i] == i)
+        {
+            if (channel[i].reverb)
+            {
+                snth_send_bus(sendR, i, n, TO_01(channel[i].reverb));
+                s |= outputV[i];
+            }
+            if (channel[i].chorus)
+            {
+                snth_send_bus(sendC, i, n, TO_01(channel[i].chorus));
+                z |= outputV[i];
+            }
+            if (surround)
+                snth_place_bus(i, n);
+            else if (stem == NULL || stem[i] == NULL)
+                snth_mix_bus(i, n);
+        }
+
+    /* Run the reverb while voices feed it or its tail is audible. */
+
+    if (s)
+        reverb.tail = reverb.decay;
+    if (reverb.tail > 0 && reverb.level)
+    {
+        snth_get_reverb(sendR, n);
+        reverb.tail -= n;
+        w = 1;
+    }
+
+    /* Run the chorus while voices feed it, and until its delay line has */
+    /* been flushed.                                                     */
+
+    if (z)
+        chorus.tail = MAXCHORUS;
+    if (chorus.tail > 0 && chorus.level)
+    {
+        snth_get_chorus(sendC, n);
+        chorus.tail -= n;
+        w = 1;
+    }
+
+    /* In surround, the mix bus holds only the effect returns. */
+
+    if (surround && w)
+        snth_place_return(n);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int snth_get_buffer(float *stem[], int n)
+{
+    int c = 0;
+    int i;
+
+    /* Initialize the working audio buffers of all routed buses. */
+
+    memset(outputL[MIXBUS], 0, n * sizeof (float));
+    outputM[MIXBUS] = 1;
+
+    if (surround)
+    {
+        for (i = 0; i < layouts[layout].n; ++i)
+            memset(outputS[i], 0, n * sizeof (float));
+
+        snth_set_spatial();
+    }
+
+    for (i = 0; i < MAXCHANNEL; ++i)
+        if (route[i] != MIXBUS)
+        {
+            memset(outputL[i], 0, n * sizeof (float));
+            outputM[i] = 1;
+            outputV[i] = 0;
+        }
+
+    /* Iterate over all notes, processing the active ones. */
+
+    for (i = 0; i < MAXNOTE; ++i)
+        if (note[i].level)
+            c += snth_get_note(note + i, n);
+
+    /* Apply sends and effect returns. */
+
+    snth_get_return(stem, n);
+
+    curr_time += n;
 
     return c;
 }
 
-/*===========================================================================*/
+/*---------------------------------------------------------------------------*/
+/* Output format conversion                                                  */
+
+/* Each converter writes n frames of one or two buses directly into the      */
+/* caller's buffer, s samples apart.  Integer formats scale, add optional    */
+/* TPDF dither of one LSB, and saturate.  Four frames go at a time where     */
+/* SSE2 is available, and any remaining frames go one at a time.             */
+
+static uint32_t dither_seed[4] = { 0x12345678, 0x9ABCDEF1,
+                                   0x3C6EF372, 0xA54FF53A };
+
+/* Metering accumulates the peak and the sum of squares of each bus in the  */
+/* lanes of an SSE vector as the converters read it.  After each render the  */
+/* totals are published under a sequence lock, so that readers on any       */
+/* thread can take a consistent copy without blocking the renderer.         */
+
+static int      metering = 0;
+static __m128   meter_pk[MAXMETER];
+static __m128   meter_sq[MAXMETER];
+static int      meter_n [MAXMETER];
+
+static volatile unsigned meter_seq = 0;
+static float             meter_peak[MAXMETER];
+static float             meter_rms [MAXMETER];
+
+static void snth_meter4(int a, __m128 x)
+{
+    const __m128 sgn = _mm_set1_ps(-0.0f);
+
+    meter_pk[a] = _mm_max_ps(meter_pk[a], _mm_andnot_ps(sgn, x));
+    meter_sq[a] = _mm_add_ps(meter_sq[a], _mm_mul_ps(x, x));
+}
+
+static void snth_meter1(int a, float x)
+{
+    snth_meter4(a, _mm_set_ss(x));
+}
+
+static float snth_rand1(void)
+{
+    uint32_t x = dither_seed[0];
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x <<  5;
+
+    dither_seed[0] = x;
+
+    return (float) (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static int32_t snth_put_int1(float x, float k, int d)
+{
+    x = (x < -1.0f) ? -1.0f : ((x > 1.0f) ? 1.0f : x);
+    x = x * k;
+
+    if (d)
+    {
+        x += snth_rand1() - snth_rand1();
+        x  = (x < -k) ? -k : ((x > k) ? k : x);
+    }
+    return (int32_t) F2I(x);
+}
+
+static void snth_put_int1s(void *dst, int w, int i, int32_t x)
+{
+    if (w == 2)
+        ((int16_t *) dst)[i] = (int16_t) x;
+    else
+        ((int32_t *) dst)[i] = (int32_t) x;
+}
+
+#ifdef __SSE2__
+
+static __m128 snth_rand4(__m128i *s)
+{
+    __m128i x = *s;
+
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x,  5));
+
+    *s = x;
+
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)),
+                      _mm_set1_ps(1.0f / 16777216.0f));
+}
+
+static __m128i snth_put_int4(__m128 x, __m128 k, __m128i *s, int d)
+{
+    const __m128 v1 = _mm_set1_ps(1.0f);
+
+    x = _mm_mul_ps(_mm_min_ps(_mm_max_ps(x, _mm_sub_ps(_mm_setzero_ps(), v1)),
+                              v1), k);
+    if (d)
+    {
+        x = _mm_add_ps(x, _mm_sub_ps(snth_rand4(s), snth_rand4(s)));
+        x = _mm_min_ps(_mm_max_ps(x, _mm_sub_ps(_mm_setzero_ps(), k)), k);
+    }
+    return _mm_cvtps_epi32(x);
+}
+
+#endif /* __SSE2__ */
+
+static void snth_put_int(void *dst, int w, int s,
+                         const float *X, int n, int a, float k, int d)
+{
+    int i = 0;
+    int j;
+
+#ifdef __SSE2__
+    const __m128 kk = _mm_set1_ps(k);
+
+    __m128i r = _mm_loadu_si128((const __m128i *) dither_seed);
+    __m128i x;
+
+    int32_t t[4];
+
+    for (; i + 4 <= n; i += 4)
+    {
+        if (a >= 0) snth_meter4(a, _mm_loadu_ps(X + i));
+
+        x = snth_put_int4(_mm_loadu_ps(X + i), kk, &r, d);
+
+        if (s == 1 && w == 2)
+            _mm_storel_epi64((__m128i *) ((int16_t *) dst + i),
+                             _mm_packs_epi32(x, x));
+        else if (s == 1)
+            _mm_storeu_si128((__m128i *) ((int32_t *) dst + i), x);
+        else
+        {
+            _mm_storeu_si128((__m128i *) t, x);
+
+            for (j = 0; j < 4; ++j)
+                snth_put_int1s(dst, w, (i + j) * s, t[j]);
+        }
+    }
+    _mm_storeu_si128((__m128i *) dither_seed, r);
+#endif
+
+    for (; i < n; ++i)
+    {
+        if (a >= 0) snth_meter1(a, X[i]);
+
+        snth_put_int1s(dst, w, i * s, snth_put_int1(X[i], k, d));
+    }
+}
+
+static void snth_put_int2(void *dst, int w, const float *L,
+                          const float *R, int n, int a, float k, int d)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128 kk = _mm_set1_ps(k);
+
+    __m128i r = _mm_loadu_si128((const __m128i *) dither_seed);
+    __m128i l;
+    __m128i x;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        if (a >= 0)
+        {
+            snth_meter4(a + 0, _mm_loadu_ps(L + i));
+            snth_meter4(a + 1, _mm_loadu_ps(R + i));
+        }
+
+        l = snth_put_int4(_mm_loadu_ps(L + i), kk, &r, d);
+        x = snth_put_int4(_mm_loadu_ps(R + i), kk, &r, d);
+
+        if (w == 2)
+            _mm_storeu_si128((__m128i *) ((int16_t *) dst + 2 * i),
+                             _mm_packs_epi32(_mm_unpacklo_epi32(l, x),
+                                             _mm_unpackhi_epi32(l, x)));
+        else
+        {
+            _mm_storeu_si128((__m128i *) ((int32_t *) dst + 2 * i + 0),
+                             _mm_unpacklo_epi32(l, x));
+            _mm_storeu_si128((__m128i *) ((int32_t *) dst + 2 * i + 4),
+                             _mm_unpackhi_epi32(l, x));
+        }
+    }
+    _mm_storeu_si128((__m128i *) dither_seed, r);
+#endif
+
+    for (; i < n; ++i)
+    {
+        if (a >= 0)
+        {
+            snth_meter1(a + 0, L[i]);
+            snth_meter1(a + 1, R[i]);
+        }
+
+        snth_put_int1s(dst, w, 2 * i + 0, snth_put_int1(L[i], k, d));
+        snth_put_int1s(dst, w, 2 * i + 1, snth_put_int1(R[i], k, d));
+    }
+}
+
+static float snth_put_flt1(float x)
+{
+    return (x < -1.0f) ? -1.0f : ((x > 1.0f) ? 1.0f : x);
+}
+
+static void snth_put_flt(float *dst, int s, const float *X, int n, int a)
+{
+    const __m128 v0 = _mm_set1_ps(-1.0f);
+    const __m128 v1 = _mm_set1_ps(+1.0f);
+
+    __m128 x;
+    float  t[4];
+    int    i = 0;
+    int    j;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        x = _mm_loadu_ps(X + i);
+
+        if (a >= 0) snth_meter4(a, x);
+
+        x = _mm_min_ps(_mm_max_ps(x, v0), v1);
+
+        if (s == 1)
+            _mm_storeu_ps(dst + i, x);
+        else
+        {
+            _mm_storeu_ps(t, x);
+
+            for (j = 0; j < 4; ++j)
+                dst[(i + j) * s] = t[j];
+        }
+    }
+
+    for (; i < n; ++i)
+    {
+        if (a >= 0) snth_meter1(a, X[i]);
+
+        dst[i * s] = snth_put_flt1(X[i]);
+    }
+}
+
+static void snth_put_flt2(float *dst, const float *L,
+                          const float *R, int n, int a)
+{
+    const __m128 v0 = _mm_set1_ps(-1.0f);
+    const __m128 v1 = _mm_set1_ps(+1.0f);
+
+    __m128 l;
+    __m128 r;
+    int    i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        l = _mm_loadu_ps(L + i);
+        r = _mm_loadu_ps(R + i);
+
+        if (a >= 0)
+        {
+            snth_meter4(a + 0, l);
+            snth_meter4(a + 1, r);
+        }
+
+        l = _mm_min_ps(_mm_max_ps(l, v0), v1);
+        r = _mm_min_ps(_mm_max_ps(r, v0), v1);
+
+        _mm_storeu_ps(dst + 2 * i + 0, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(l, r));
+    }
+
+    for (; i < n; ++i)
+    {
+        if (a >= 0)
+        {
+            snth_meter1(a + 0, L[i]);
+            snth_meter1(a + 1, R[i]);
+        }
+
+        dst[2 * i + 0] = snth_put_flt1(L[i]);
+        dst[2 * i + 1] = snth_put_flt1(R[i]);
+    }
+}
+
+static void snth_put_output(void *buf[], size_t o, float *const src[],
+                            int N, int n, const struct snth_format *f)
+{
+    const int   w = (f->type == SNTH_FORMAT_S16) ? 2 : 4;
+    const int   d = (f->type == SNTH_FORMAT_S32) ? 0 : (f->dither ? 1 : 0);
+    const float k = (f->type == SNTH_FORMAT_S16) ? 32767.0f
+                  : (f->type == SNTH_FORMAT_S24) ? 8388607.0f
+                  :                                2147483520.0f;
+    const int   a = metering ? 0 : -1;
+    int j;
+
+    /* Convert interleaved stereo two buses at a time. */
+
+    if (N == 2 && !f->planar)
+    {
+        char *dst = (char *) buf[0] + 2 * o * w;
+
+        if (f->type == SNTH_FORMAT_F32)
+            snth_put_flt2((float *) dst, src[0], src[1], n, a);
+        else
+            snth_put_int2(dst, w, src[0], src[1], n, a, k, d);
+    }
+
+    /* Convert anything else one bus at a time. */
+
+    else for (j = 0; j < N; ++j)
+    {
+        char *dst = f->planar ? (char *) buf[j] + o * w
+                              : (char *) buf[0] + (o * N + j) * w;
+        int   s   = f->planar ? 1 : N;
+
+        if (f->type == SNTH_FORMAT_F32)
+            snth_put_flt((float *) dst, s, src[j], n, a < 0 ? a : j);
+        else
+            snth_put_int(dst, w, s, src[j], n, a < 0 ? a : j, k, d);
+    }
+
+    if (a >= 0)
+        for (j = 0; j < N; ++j)
+            meter_n[j] += n;
+}
+
+static void snth_put_stem(float *stem, int b, int n)
+{
+    const float *L = outputL[b];
+    const float *R = outputM[b] ? outputL[b] : outputR[b];
+
+    const int a = MAXSPEAKER + 2 * b;
+
+    __m128 l;
+    __m128 r;
+    int    i;
+
+    /* Copy unclamped bus audio to an interleaved stereo stem. */
+
+    if (metering == 0)
+        vec_interleave(stem, L, R, n);
+
+    /* Meter it along the way, if requested. */
+
+    else
+    {
+        for (i = 0; i < n; i += 4)
+        {
+            l = _mm_load_ps(L + i);
+            r = _mm_load_ps(R + i);
+
+            snth_meter4(a + 0, l);
+            snth_meter4(a + 1, r);
+
+            _mm_storeu_ps(stem + 2 * i + 0, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(stem + 2 * i + 4, _mm_unpackhi_ps(l, r));
+        }
+        meter_n[a + 0] += n;
+        meter_n[a + 1] += n;
+    }
+}
+
+static void snth_put_meter(int a, int z)
+{
+    int i;
+
+    /* Publish the meters in [a, z), bracketed by an odd sequence number. */
+
+    meter_seq++;
+    __sync_synchronize();
+
+    for (i = a; i < z; ++i)
+        if (meter_n[i])
+        {
+            meter_peak[i] = snth_hmax(meter_pk[i]);
+            meter_rms [i] = sqrtf(snth_hsum(meter_sq[i]) / meter_n[i]);
+
+            meter_pk[i] = _mm_setzero_ps();
+            meter_sq[i] = _mm_setzero_ps();
+            meter_n [i] = 0;
+        }
+
+    __sync_synchronize();
+    meter_seq++;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Event queue                                                               */
+
+/* Posted MIDI messages wait here, sorted by absolute frame time, with their */
+/* bytes packed into an arena.  Rendering stops at each vector boundary that */
+/* an event falls within, applies it, and continues.                         */
+
+static struct snth_event event[MAXEVENT];
+static uint8_t           event_data[MAXEVDATA];
+static uint8_t           event_temp[MAXEVDATA];
+static int               event_head = 0;
+static int               event_tail = 0;
+static int               event_used = 0;
+
+static int snth_out_time(void);
+
+static int snth_has_event_room(size_t n)
+{
+    return (event_tail < MAXEVENT && event_used + n <= MAXEVDATA);
+}
+
+static void snth_put_event(int time, const void *d, size_t n)
+{
+    int i;
+
+    /* Apply the message immediately if the queue is full. */
+
+    if (!snth_has_event_room(n) || n > 0xFFFF)
+    {
+        snth_midi(d, n);
+        return;
+    }
+
+    /* Insert it after all events at the same or earlier times. */
+
+    for (i = event_tail; i > event_head && event[i - 1].time > time; --i)
+        event[i] = event[i - 1];
+
+    event[i].time = time;
+    event[i].off  = (uint16_t) event_used;
+    event[i].len  = (uint16_t) n;
+
+    memcpy(event_data + event_used, d, n);
+
+    event_used += (int) n;
+    event_tail += 1;
+}
+
+static void snth_run_events(void)
+{
+    /* Apply all events falling within the next vector.  One that may edit */
+    /* patches waits, with all after it, while another thread is editing.  */
+
+    while (event_head < event_tail && event[event_head].time - curr_time < 4)
+    {
+        const uint8_t *d = event_data + event[event_head].off;
+        const size_t   n = event[event_head].len;
+        const int      e = (memchr(d, 0xF0, n) != NULL);
+
+        if (e && !snth_try_edit())
+            break;
+
+        note_time = event[event_head].time;
+        snth_midi(d, n);
+        note_time = curr_time;
+
+        if (e) snth_give_edit();
+
+        event_head++;
+    }
+
+    /* Move the waiting events and their data to the front of the queue, */
+    /* so that a steady stream never fills it.                            */
+
+    if (event_head > 0)
+    {
+        int i;
+        int n = 0;
+
+        for (i = event_head; i < event_tail; ++i)
+        {
+            memcpy(event_temp + n, event_data + event[i].off, event[i].len);
+
+            event[i - event_head]     = event[i];
+            event[i - event_head].off = (uint16_t) n;
+
+            n += event[i].len;
+        }
+        memcpy(event_data, event_temp, n);
+
+        event_tail -= event_head;
+        event_head  = 0;
+        event_used  = n;
+    }
+}
+
+static int snth_cut_events(int n)
+{
+    /* Shorten a chunk to end at the vector holding the next event.  An */
+    /* event put off past its time retries at the next chunk.           */
+
+    if (event_head < event_tail)
+    {
+        int d = (event[event_head].time - curr_time) & ~3;
+
+        if (0 < d && d < n)
+            n = d;
+    }
+    return n;
+}
+
+void snth_post_midi(size_t frame, const void *d, size_t n)
+{
+    snth_put_event(snth_out_time() + (int) frame, d, n);
+}
+
+void snth_post_note_on(size_t frame, uint8_t chan, uint8_t pitch,
+                                     uint8_t level)
+{
+    uint8_t d[3] = { (uint8_t) (0x90 | (chan & 0x0F)), pitch, level };
+
+    snth_post_midi(frame, d, 3);
+}
+
+void snth_post_note_off(size_t frame, uint8_t chan, uint8_t pitch,
+                                      uint8_t level)
+{
+    uint8_t d[3] = { (uint8_t) (0x80 | (chan & 0x0F)), pitch, level };
+
+    snth_post_midi(frame, d, 3);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Event ring                                                                */
+
+/* Sent messages cross from producer threads to the audio thread through a   */
+/* byte ring.  Each record is an 8-byte stamp, a 2-byte length, a 1-byte     */
+/* kind, and the message.  Producers only advance the tail and the consumer  */
+/* only advances the head, so the audio thread never waits.  Producers take  */
+/* turns at the tail among themselves.                                       */
+
+/* A stamp is either a frame offset from the next output or a time on the    */
+/* caller's clock, mapped to frames by the clock anchor of each render.      */
+
+#define RING_FRAME 0
+#define RING_CLOCK 1
+#define RING_HEAD  11
+
+static uint8_t           ring[MAXRING];
+static uint8_t           ring_msg[MAXRING];
+static volatile unsigned ring_head = 0;
+static volatile unsigned ring_tail = 0;
+static volatile int      ring_lock = 0;
+static double            ring_clock = 0.0;
+
+static void snth_ring_put(unsigned i, const void *d, size_t n)
+{
+    const uint8_t *p = (const uint8_t *) d;
+    size_t k;
+
+    for (k = 0; k < n; ++k)
+        ring[(i + k) & (MAXRING - 1)] = p[k];
+}
+
+static void snth_ring_get(unsigned i, void *d, size_t n)
+{
+    uint8_t *p = (uint8_t *) d;
+    size_t k;
+
+    for (k = 0; k < n; ++k)
+        p[k] = ring[(i + k) & (MAXRING - 1)];
+}
+
+static void snth_get_ring(void)
+{
+    unsigned h = ring_head;
+    unsigned t = ring_tail;
+
+    /* Read nothing of a record before its tail is seen. */
+
+    __sync_synchronize();
+
+    while (h != t)
+    {
+        double   stamp;
+        uint16_t n;
+        uint8_t  k;
+
+        snth_ring_get(h,      &stamp, 8);
+        snth_ring_get(h +  8, &n,     2);
+        snth_ring_get(h + 10, &k,     1);
+
+        /* Leave the rest in the ring while the queue is full, rather than */
+        /* apply it out of order.                                          */
+
+        if (!snth_has_event_room(n))
+            break;
+
+        snth_ring_get(h + RING_HEAD, ring_msg, n);
+
+        /* Map clock times to frames.  Late messages apply at once. */
+
+        if (k == RING_CLOCK)
+            stamp = floor((stamp - ring_clock) * rate + 0.5);
+        if (stamp < 0)
+            stamp = 0;
+
+        snth_put_event(snth_out_time() + (int) stamp, ring_msg, n);
+
+        h += RING_HEAD + n;
+    }
+
+    /* Release the space only after it has been read. */
+
+    __sync_synchronize();
+
+    ring_head = h;
+}
+
+static int snth_put_ring(uint8_t k, double stamp, const void *d, size_t n)
+{
+    unsigned h;
+    unsigned t;
+
+    uint16_t l = (uint16_t) n;
+
+    while (__sync_lock_test_and_set(&ring_lock, 1))
+        sched_yield();
+
+    h = ring_head;
+    t = ring_tail;
+
+    /* Refuse the message if it does not fit. */
+
+    if (n > 0xFFFF || RING_HEAD + n > MAXRING - (t - h))
+    {
+        __sync_lock_release(&ring_lock);
+        return 0;
+    }
+
+    snth_ring_put(t,      &stamp, 8);
+    snth_ring_put(t +  8, &l,     2);
+    snth_ring_put(t + 10, &k,     1);
+    snth_ring_put(t + RING_HEAD, d, n);
+
+    /* Publish the record only after it has been written. */
+
+    __sync_synchronize();
+
+    ring_tail = t + RING_HEAD + n;
+
+    __sync_lock_release(&ring_lock);
+    return 1;
+}
+
+int snth_send_midi(size_t frame, const void *d, size_t n)
+{
+    return snth_put_ring(RING_FRAME, (double) frame, d, n);
+}
+
+int snth_send_midi_at(double time, const void *d, size_t n)
+{
+    return snth_put_ring(RING_CLOCK, time, d, n);
+}
+
+void snth_set_clock(double time)
+{
+    ring_clock = time;
+}
+
+int snth_send_note_on(size_t frame, uint8_t chan, uint8_t pitch,
+                                    uint8_t level)
+{
+    uint8_t d[3] = { (uint8_t) (0x90 | (chan & 0x0F)), pitch, level };
+
+    return snth_send_midi(frame, d, 3);
+}
+
+int snth_send_note_off(size_t frame, uint8_t chan, uint8_t pitch,
+                                     uint8_t level)
+{
+    uint8_t d[3] = { (uint8_t) (0x80 | (chan & 0x0F)), pitch, level };
+
+    return snth_send_midi(frame, d, 3);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* Audio is rendered in whole SSE vectors.  When a request ends part way     */
+/* through a vector, the remaining frames are held for the next request.     */
+
+static float hold[MAXSPEAKER][4];
+static int   hold_i = 0;
+static int   hold_n = 0;
+
+static int snth_out_time(void)
+{
+    /* Posted frame offsets count from the next frame delivered. */
+
+    return curr_time - hold_n;
+}
+
+int snth_render(void *buffer[], size_t frames, const struct snth_format *f)
+{
+    const int N = layouts[layout].n;
+
+    float *src[MAXSPEAKER];
+    size_t count = 0;
+    int c = 0;
+    int m = 0;
+    int j;
+
+    surround = (layout != SNTH_LAYOUT_STEREO);
+
+    snth_enter_render();
+
+    /* Queue any messages sent since the previous request, and apply any */
+    /* shared parameters changed since then.                             */
+
+    snth_get_ring();
+    snth_get_shared();
+
+    /* Deliver any frames held over from the previous request. */
+
+    if (hold_n && count < frames)
+    {
+        int n = ((frames - count) < (size_t) hold_n ?
+                 (int) (frames - count) : hold_n);
+
+        for (j = 0; j < N; ++j)
+            src[j] = hold[j] + hold_i;
+
+        snth_put_output(buffer, count, src, N, n, f);
+
+        hold_i += n;
+        hold_n -= n;
+        count  += n;
+    }
+
+    /* Continue processing audio until the given buffer is full. */
+
+    while (count < frames)
+    {
+        int n;
+        int v;
+
+        /* Apply due events and end the chunk at the next one. */
+
+        snth_run_events();
+
+        n = ((frames - count) < MAXFRAME ? (int) (frames - count) : MAXFRAME);
+        n = snth_cut_events(n);
+        v = (n + 3) & ~3;
+
+        /* Route all channels to the mix bus, except those with sends. */
+
+        snth_set_route(NULL);
+
+        /* Process a chunk of audio. */
+
+        c = snth_get_buffer(NULL, v);
+
+        if (m < c)
+            m = c;
+
+        if (surround)
+            for (j = 0; j < N; ++j)
+                src[j] = outputS[j];
+        else
+        {
+            /* The limiter keeps separate left and right histories. */
+
+            if (limiter.level)
+                snth_split_output(MIXBUS, v);
+
+            src[0] = outputL[MIXBUS];
+            src[1] = outputM[MIXBUS] ? outputL[MIXBUS] : outputR[MIXBUS];
+        }
+
+        if (limiter.level)
+            snth_get_limiter(src, N, v);
+
+        snth_put_output(buffer, count, src, N, n, f);
+
+        /* Hold any frames beyond the end of the request. */
+
+        if ((hold_n = v - n))
+        {
+            for (j = 0; j < N; ++j)
+                memcpy(hold[j], src[j] + n, hold_n * sizeof (float));
+
+            hold_i = 0;
+        }
+
+        count += n;
+    }
+
+    if (metering)
+        snth_put_meter(0, N);
+
+    snth_leave_render();
+
+    return c;
+}
+
+int snth_get_output(void *buffer, size_t frames)
+{
+    static const struct snth_format f = { SNTH_FORMAT_S16, 0, 0 };
+
+    return snth_render(&buffer, frames, &f);
+}
+
+int snth_get_stems(float *stem[], size_t frames)
+{
+    size_t count;
+    int c = 0;
+    int i;
+
+    assert((frames % 4) == 0);
+    assert(hold_n == 0);
+
+    /* Frames held over by snth_render have no stems.  Discard them rather */
+    /* than shift the stems against the output that preceded them.        */
+
+    hold_n = 0;
+
+    surround = 0;
+
+    snth_enter_render();
+
+    /* Queue any messages sent since the previous request, and apply any */
+    /* shared parameters changed since then.                             */
+
+    snth_get_ring();
+    snth_get_shared();
+
+    /* Continue processing audio until the given buffers are full. */
+
+    for (count = 0; count < frames; )
+    {
+        size_t n;
+
+        /* Apply due events and end the chunk at the next one. */
+
+        snth_run_events();
+
+        n = ((frames - count) < MAXFRAME ? (frames - count) : MAXFRAME);
+        n = (size_t) snth_cut_events((int) n);
+
+        /* Route each channel with a stem to its own bus.  Mix all others. */
+
+        snth_set_route(stem);
+
+        /* Process a chunk of audio and distribute it among the stems. */
+
+        c = snth_get_buffer(stem, (int) n);
+
+        for (i = 0; i < MAXCHANNEL; ++i)
+            if (stem[i])
+                snth_put_stem(stem[i] + 2 * count, i, (int) n);
+
+        if (stem[SNTH_STEM_MIX])
+            snth_put_stem(stem[SNTH_STEM_MIX] + 2 * count, MIXBUS, (int) n);
+
+        count += n;
+    }
+
+    if (metering)
+        snth_put_meter(MAXSPEAKER, MAXMETER);
+
+    snth_leave_render();
+
+    return c;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void snth_set_meter(int on)
+{
+    metering = on;
+}
+
+int snth_get_meter(float *peak, float *rms, size_t n)
+{
+    unsigned s;
+
+    if (n > MAXMETER)
+        n = MAXMETER;
+
+    /* Copy the published meters, retrying if a render updated them. */
+
+    do
+    {
+        while ((s = meter_seq) & 1)
+            ;
+
+        __sync_synchronize();
+
+        if (peak) memcpy(peak, meter_peak, n * sizeof (float));
+        if (rms)  memcpy(rms,  meter_rms,  n * sizeof (float));
+
+        __sync_synchronize();
+    }
+    while (s != meter_seq);
+
+    return (int) n;
+}
+
+/*===========================================================================*/
+
+void snth_set_channel(uint8_t i)
+{
+    assert(i < MAXCHANNEL);
+    snth_enter_state();
+    curr_chan = i;
+    snth_leave_state();
+}
+
+void snth_set_patch(uint8_t i)
+{
+    assert(i < MAXPATCH);
+    snth_enter_state();
+    channel[curr_chan].patch = i;
+    snth_leave_state();
+}
+
+void snth_set_bank(uint8_t i)
+{
+    snth_enter_state();
+    channel[curr_chan].bank = i;
+    snth_leave_state();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void snth_set_channel_level(uint8_t level)
+{
+    snth_enter_state();
+    channel[curr_chan].level = level;
+    snth_leave_state();
+}
+
+void snth_set_channel_pan(uint8_t pan)
+{
+    snth_enter_state();
+    channel[curr_chan].pan = pan;
+    snth_leave_state();
+}
+
+void snth_set_channel_reverb(uint8_t reverb)
+{
+    snth_enter_state();
+    channel[curr_chan].reverb = reverb;
+    snth_leave_state();
+}
+
+void snth_set_channel_chorus(uint8_t chorus)
+{
+    snth_enter_state();
+    channel[curr_chan].chorus = chorus;
+    snth_leave_state();
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void snth_set_shelf(float *q, float f, float g, float d)
+{
+    /* Compute a shelving biquad.  d = -1 for low shelf, +1 for high shelf. */
+
+    float A  = powf(10.0f, g / 40.0f);
+    float w  = 6.2831853071795864f * f / rate;
+    float cs = cosf(w);
+    float a  = sinf(w) * sqrtf(A) * 1.4142135623730950f;
+
+    float b0 =        A * ((A + 1) + d * (A - 1) * cs + a);
+    float b1 = -2 * d * A * ((A - 1) + d * (A + 1) * cs);
+    float b2 =        A * ((A + 1) + d * (A - 1) * cs - a);
+    float a0 =             (A + 1) - d * (A - 1) * cs + a;
+    float a1 =  2 * d *     ((A - 1) - d * (A + 1) * cs);
+    float a2 =             (A + 1) - d * (A - 1) * cs - a;
+
+    q[0] = b0 / a0;
+    q[1] = b1 / a0;
+    q[2] = b2 / a0;
+    q[3] = a1 / a0;
+    q[4] = a2 / a0;
+}
+
+static void snth_set_peak(float *q, float f, float g, float Q)
+{
+    /* Compute a peaking biquad. */
+
+    float A  = powf(10.0f, g / 40.0f);
+    float w  = 6.2831853071795864f * f / rate;
+    float cs = cosf(w);
+    float a  = sinf(w) / (2.0f * Q);
+
+    float a0 = 1 + a / A;
+
+    q[0] = (1 + a * A) / a0;
+    q[1] = (-2 * cs)   / a0;
+    q[2] = (1 - a * A) / a0;
+    q[3] = (-2 * cs)   / a0;
+    q[4] = (1 - a / A) / a0;
+}
+
+static void snth_set_flat(float *q)
+{
+    q[0] = 1.0f;
+    q[1] = 0.0f;
+    q[2] = 0.0f;
+    q[3] = 0.0f;
+    q[4] = 0.0f;
+}
+
+static void snth_set_insert_cache(uint8_t i)
+{
+    struct snth_channel *h = channel + i;
+
+    float hi = (5000.0f < 0.45f * rate) ? 5000.0f : 0.45f * rate;
+    float fm = 200.0f * powf(25.0f, TO_01(h->eq_freq));
+    float d  = TO_01(h->drive);
+
+    if (fm > 0.45f * rate)
+        fm = 0.45f * rate;
+
+    /* Recompute the EQ coefficients, leaving flat bands as identity. */
+
+    if (h->eq_low  != DEF_CHANNEL_EQ_LOW)
+        snth_set_shelf(h->eq[0], 200.0f, 12.0f * TO_11(h->eq_low),  -1.0f);
+    else
+        snth_set_flat (h->eq[0]);
+
+    if (h->eq_mid  != DEF_CHANNEL_EQ_MID)
+        snth_set_peak (h->eq[1], fm,     12.0f * TO_11(h->eq_mid),   0.7f);
+    else
+        snth_set_flat (h->eq[1]);
+
+    if (h->eq_high != DEF_CHANNEL_EQ_HIGH)
+        snth_set_shelf(h->eq[2], hi,     12.0f * TO_11(h->eq_high), +1.0f);
+    else
+        snth_set_flat (h->eq[2]);
+
+    h->dk = 8.0f * d * d;
+
+    /* Flag the insert active only if some stage departs from identity. */
+
+    h->flags = ((h->eq_low  != DEF_CHANNEL_EQ_LOW)  ||
+                (h->eq_mid  != DEF_CHANNEL_EQ_MID)  ||
+                (h->eq_high != DEF_CHANNEL_EQ_HIGH) ||
+                (h->drive   != DEF_CHANNEL_DRIVE));
+
+    if (h->flags == 0)
+        memset(h->eqz, 0, sizeof (h->eqz));
+}
+
+void snth_set_channel_eq_low(uint8_t eq_low)
+{
+    snth_enter_state();
+    channel[curr_chan].eq_low = eq_low;
+    snth_set_insert_cache(curr_chan);
+    snth_leave_state();
+}
+
+void snth_set_channel_eq_mid(uint8_t eq_mid)
+{
+    snth_enter_state();
+    channel[curr_chan].eq_mid = eq_mid;
+    snth_set_insert_cache(curr_chan);
+    snth_leave_state();
+}
+
+void snth_set_channel_eq_freq(uint8_t eq_freq)
+{
+    snth_enter_state();
+    channel[curr_chan].eq_freq = eq_freq;
+    snth_set_insert_cache(curr_chan);
+    snth_leave_state();
+}
+
+void snth_set_channel_eq_high(uint8_t eq_high)
+{
+    snth_enter_state();
+    channel[curr_chan].eq_high = eq_high;
+    snth_set_insert_cache(curr_chan);
+    snth_leave_state();
+}
+
+void snth_set_channel_drive(uint8_t drive)
+{
+    snth_enter_state();
+    channel[curr_chan].drive = drive;
+    snth_set_insert_cache(curr_chan);
+    snth_leave_state();
+}
+
+void snth_set_channel_azimuth(uint8_t azimuth)
+{
+    snth_enter_state();
+    channel[curr_chan].azimuth = azimuth;
+    snth_leave_state();
+}
+
+void snth_set_channel_elevation(uint8_t elevation)
+{
+    snth_enter_state();
+    channel[curr_chan].elevation = elevation;
+    snth_leave_state();
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void snth_set_reverb_cache(void)
+{
+    static const int base[MAXLINE] = { 1557, 1617, 1491, 1422 };
+
+    struct snth_reverb *V = &reverb;
+
+    float t = 0.1f + 9.9f * TO_01(V->time) * TO_01(V->time);
+    float s = 0.5f + TO_01(V->size);
+
+    int i;
+
+    /* Recompute the delay lengths and the per-line feedback gains. */
+
+    for (i = 0; i < MAXLINE; ++i)
+    {
+        int l = (int) (base[i] * s * rate / 44100);
+
+        V->len[i] = (l < MAXREVERB) ? l : MAXREVERB;
+        V->fb [i] = powf(10.0f, -3.0f * V->len[i] / (t * rate));
+
+        if (V->pos[i] >= V->len[i])
+            V->pos[i] = 0;
+    }
+
+    V->lp    = 0.9f * TO_01(V->damp);
+    V->decay = (int) (t * rate);
+}
+
+void snth_set_reverb_level(uint8_t level)
+{
+    snth_enter_state();
+    reverb.level = level;
+    snth_leave_state();
+}
+
+void snth_set_reverb_time(uint8_t time)
+{
+    snth_enter_state();
+    reverb.time = time;
+    snth_set_reverb_cache();
+    snth_leave_state();
+}
+
+void snth_set_reverb_damp(uint8_t damp)
+{
+    snth_enter_state();
+    reverb.damp = damp;
+    snth_set_reverb_cache();
+    snth_leave_state();
+}
+
+void snth_set_reverb_size(uint8_t size)
+{
+    snth_enter_state();
+    reverb.size = size;
+    snth_set_reverb_cache();
+    snth_leave_state();
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void snth_set_chorus_cache(void)
+{
+    struct snth_chorus *H = &chorus;
+
+    /* Rate spans 0.05-5Hz, delay 5-30ms, and depth 0-10ms of sweep. */
+
+    float f = 0.05f + 4.95f * TO_01(H->rate) * TO_01(H->rate);
+    float d = 0.005f + 0.025f * TO_01(H->delay);
+    float w = 0.010f * TO_01(H->depth);
+
+    H->freq  = f / rate;
+    H->base  = d * rate;
+    H->width = w * rate;
+
+    /* Keep the longest tap, plus interpolation, inside the line. */
+
+    if (H->base + H->width > MAXCHORUS - 2)
+        H->width = MAXCHORUS - 2 - H->base;
+    if (H->width < 0)
+    {
+        H->base  = MAXCHORUS - 2;
+        H->width = 0;
+    }
+}
+
+void snth_set_chorus_level(uint8_t level)
+{
+    snth_enter_state();
+    chorus.level = level;
+    snth_leave_state();
+}
+
+void snth_set_chorus_rate(uint8_t rate)
+{
+    snth_enter_state();
+    chorus.rate = rate;
+    snth_set_chorus_cache();
+    snth_leave_state();
+}
+
+void snth_set_chorus_depth(uint8_t depth)
+{
+    snth_enter_state();
+    chorus.depth = depth;
+    snth_set_chorus_cache();
+    snth_leave_state();
+}
+
+void snth_set_chorus_delay(uint8_t delay)
+{
+    snth_enter_state();
+    chorus.delay = delay;
+    snth_set_chorus_cache();
+    snth_leave_state();
+}
+
+static void snth_reset_limiter(void)
+{
+    int i;
+
+    /* Empty the delay line and restore unity gain. */
+
+    memset(limiter.delay, 0, sizeof (limiter.delay));
+
+    for (i = 0; i < MAXLIMIT; ++i)
+    {
+        limiter.req[i] = 1.0f;
+        limiter.min[i] = 1.0f;
+    }
+    limiter.gain = 1.0f;
+    limiter.pos  = 0;
+}
+
+static void snth_set_limiter_cache(void)
+{
+    struct snth_limiter *M = &limiter;
+
+    /* Level spans a -24 to 0dB ceiling.  Release spans 10ms to 1s. */
+
+    float t = 0.01f * powf(100.0f, TO_01(M->release));
+
+    M->thr = powf(10.0f, -1.2f * (1.0f - TO_01(M->level)));
+    M->rel = 1.0f - expf(-4.0f / (t * rate));
+}
+
+void snth_set_limiter_level(uint8_t level)
+{
+    /* Start from silence whenever the limiter is switched on. */
+
+    snth_enter_state();
+
+    if (limiter.level == 0 && level != 0)
+        snth_reset_limiter();
+
+    limiter.level = level;
+    snth_set_limiter_cache();
+
+    snth_leave_state();
+}
+
+void snth_set_limiter_release(uint8_t release)
+{
+    snth_enter_state();
+    limiter.release = release;
+    snth_set_limiter_cache();
+    snth_leave_state();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void snth_set_smooth_time(uint8_t time)
+{
+    /* Smoothing time spans 0 to 4s in frames, as do envelope times. */
+
+    snth_enter_state();
+    smooth_time = time;
+    smooth_t    = TO_DT(time);
+    snth_leave_state();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void snth_set_layout(int l)
+{
+    assert(0 <= l && l < (int) (sizeof (layouts) / sizeof (layouts[0])));
+
+    /* A change in the number of outputs invalidates all held audio. */
+
+    if (layout != l)
+    {
+        layout = l;
+        hold_n = 0;
+        snth_reset_limiter();
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void snth_set_patch_cache(uint8_t i)
+{
+    /* Publish a changed patch now, or at the commit of a bulk edit. */
+
+    edit_dirty[i] = 1;
+
+    if (edit_depth == 0)
+        snth_put_patches();
+}
+
+void snth_set_patch_name(const char *name)
+{
+    if (snth_take_edit())
+    {
+        strncpy(edit[snth_curr_patch()].name, name, MAXSTR);
+        snth_set_patch_cache(snth_curr_patch());
+        snth_give_edit();
+    }
+}
+
+static void snth_set_tone_flags(uint8_t i, uint8_t j)
+{
+    struct snth_tone *t = edit[i].tone + j;
+
+    uint8_t  m = j ? edit[i].tone[j - 1].mode : SNTH_MODE_OFF;
+    uint16_t f = 0;
+
+    /* Determine the envelope enable states. */
+
+    if (t->env[0].flags)                                         f |= FL_ENV0;
+    if (t->env[1].flags && t->pitch_env  != DEF_TONE_PITCH_ENV)  f |= FL_ENV1;
+    if (t->env[2].flags && t->filter_env != DEF_TONE_FILTER_ENV) f |= FL_ENV2;
+    
+    /* Determine the LFO enable states. */
+
+    if (t->lfo[0].flags) f |= FL_LFO0;
+    if (t->lfo[1].flags) f |= FL_LFO1;
+
+    /* Determine the varying-parameter enable states. */
+
+    if (m               == SNTH_MODE_MOD ||
+        t->lfo[0].pitch != DEF_LFO_PITCH ||
+        t->lfo[1].pitch != DEF_LFO_PITCH || f & FL_ENV1) f |= FL_PITCH;
+
+    if (t->lfo[0].pan   != DEF_LFO_PAN ||
+        t->lfo[1].pan   != DEF_LFO_PAN) f |= FL_PAN;
+
+    if (t->filter_mode != DEF_TONE_FILTER_MODE ||
+        t->filter_cut  != DEF_TONE_FILTER_CUT  ||
+        t->filter_res  != DEF_TONE_FILTER_RES  ||
+        t->filter_key  != DEF_TONE_FILTER_KEY  || f & FL_ENV2) f |= FL_FILTER;
+
+    t->flags = f;
+}
+
+static void snth_set_tone_cache(uint8_t i, uint8_t j)
+{
+    /* The commit of a bulk edit recomputes all deferred caches. */
+
+    if (edit_depth == 0)
+        snth_set_tone_flags(i, j);
+
+    snth_set_patch_cache(i);
+}
+
+void snth_set_tone_wave(uint8_t tone, uint8_t wave)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].wave = wave;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_mode(uint8_t tone, uint8_t mode)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].mode = mode;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+
+        /* The following tone's cache depends upon this mode. */
+
+        if (tone + 1 < MAXTONE)
+            snth_set_tone_cache(snth_curr_patch(), tone + 1);
+
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_level(uint8_t tone, uint8_t level)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].level = level;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_pan(uint8_t tone, uint8_t pan)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].pan = pan;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_delay(uint8_t tone, uint8_t delay)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].delay = delay;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_pitch_coarse(uint8_t tone, uint8_t pitch_coarse)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].pitch_coarse = pitch_coarse;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_pitch_fine(uint8_t tone, uint8_t pitch_fine)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].pitch_fine = pitch_fine;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_pitch_env(uint8_t tone, uint8_t pitch_env)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].pitch_env = pitch_env;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_filter_mode(uint8_t tone, uint8_t filter_mode)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].filter_mode = filter_mode;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_filter_cut(uint8_t tone, uint8_t filter_cut)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].filter_cut = filter_cut;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_filter_res(uint8_t tone, uint8_t filter_res)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].filter_res = filter_res;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_filter_env(uint8_t tone, uint8_t filter_env)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].filter_env = filter_env;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+void snth_set_tone_filter_key(uint8_t tone, uint8_t filter_key)
+{
+    assert(tone < MAXTONE);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].filter_key = filter_key;
+        snth_set_tone_cache(snth_curr_patch(), tone);
+        snth_give_edit();
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void snth_set_env_cache(struct snth_env *e)
+{
+    float at = TO_DT(e->a);
+    float dt = TO_DT(e->d);
+    float sb = TO_01(e->s);
+    float rt = TO_DT(e->r);
+
+    /* Recompute the envelope state cache. */
+
+    if (at > 0)
+    {
+        e->am = 1 / at;
+        e->ab = 0;
+    }
+    else
+    {
+        e->am = 0;
+        e->ab = 1;
+    }
 
-void snth_set_channel(uint8_t i)
+    if (dt > 0)
+    {
+        e->dm =         -(1 - sb) / dt;
+        e->db = 1 + at * (1 - sb) / dt;
+    }
+    else
+    {
+        e->dm = 0;
+        e->db = sb;
+    }
+
+    if (rt > 0)
+    {
+        e->rm = -sb / rt;
+        e->rb = 0;
+    }
+    else
+    {
+        e->rm = 0;
+        e->rb = 0;
+    }
+
+    e->sb = sb;
+
+    e->flags = (uint16_t) (e->a || e->d || e->s || e->r);
+}
+
+static void snth_set_tone_env_cache(uint8_t i, uint8_t j, uint8_t k)
 {
-    assert(i < MAXCHANNEL);
-    curr_chan = i;
+    if (edit_depth == 0)
+        snth_set_env_cache(edit[i].tone[j].env + k);
+
+    snth_set_tone_cache(i, j);
 }
 
-void snth_set_patch(uint8_t i)
+void snth_set_tone_env_a(uint8_t tone, uint8_t env, uint8_t a)
 {
-    assert(i < MAXPATCH);
-    channel[curr_chan].patch = i;
+    assert(tone < MAXTONE);
+    assert(env  < MAXENV);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].env[env].a = a;
+        snth_set_tone_env_cache(snth_curr_patch(), tone, env);
+        snth_give_edit();
+    }
 }
 
-void snth_set_bank(uint8_t i)
+void snth_set_tone_env_d(uint8_t tone, uint8_t env, uint8_t d)
 {
+    assert(tone < MAXTONE);
+    assert(env  < MAXENV);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].env[env].d = d;
+        snth_set_tone_env_cache(snth_curr_patch(), tone, env);
+        snth_give_edit();
+    }
 }
 
-/*---------------------------------------------------------------------------*/
+void snth_set_tone_env_s(uint8_t tone, uint8_t env, uint8_t s)
+{
+    assert(tone < MAXTONE);
+    assert(env  < MAXENV);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].env[env].s = s;
+        snth_set_tone_env_cache(snth_curr_patch(), tone, env);
+        snth_give_edit();
+    }
+}
 
-void snth_set_patch_name(const char *name)
+void snth_set_tone_env_r(uint8_t tone, uint8_t env, uint8_t r)
 {
-    strncpy(patch[channel[curr_chan].patch].name, name, MAXSTR);
+    assert(tone < MAXTONE);
+    assert(env  < MAXENV);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].env[env].r = r;
+        snth_set_tone_env_cache(snth_curr_patch(), tone, env);
+        snth_give_edit();
+    }
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void snth_set_tone_cache(uint8_t i, uint8_t j)
+static void snth_set_lfo_cache(struct snth_lfo *l)
 {
-    struct snth_tone *t = patch[i].tone + j;
-
-    uint8_t  m = j ? patch[i].tone[j - 1].mode : SNTH_MODE_OFF;
-    uint16_t f = 0;
+    float rt = TO_DT(l->rate);
+    float dt = TO_DT(l->delay);
 
-    /* Determine the envelope enable states. */
+    l->freq = (rt > 0) ? (float) rate / rt : 0;
+    l->dm   = (dt > 0) ? (float) 1.0f / dt : 0;
 
-    if (t->env[0].flags)                                         f |= FL_ENV0;
-    if (t->env[1].flags && t->pitch_env  != DEF_TONE_PITCH_ENV)  f |= FL_ENV1;
-    if (t->env[2].flags && t->filter_env != DEF_TONE_FILTER_ENV) f |= FL_ENV2;
-    
-    /* Determine the LFO enable states. */
+    l->flags = (uint16_t) ((l->rate > 0) && (l->level  != DEF_LFO_LEVEL ||
+                                             l->pan    != DEF_LFO_PAN   ||
+                                             l->pitch  != DEF_LFO_PITCH ||
+                                             l->phase  != DEF_LFO_PHASE ||
+                                             l->filter != DEF_LFO_FILTER));
+}
 
-    if (t->lfo[0].flags) f |= FL_LFO0;
-    if (t->lfo[1].flags) f |= FL_LFO1;
+static void snth_set_tone_lfo_cache(uint8_t i, uint8_t j, uint8_t k)
+{
+    if (edit_depth == 0)
+        snth_set_lfo_cache(edit[i].tone[j].lfo + k);
 
-    /* Determine the varying-parameter enable states. */
+    snth_set_tone_cache(i, j);
+}
 
-    if (m               == SNTH_MODE_MOD ||
-        t->lfo[0].pitch != DEF_LFO_PITCH ||
-        t->lfo[1].pitch != DEF_LFO_PITCH || f & FL_ENV1) f |= FL_PITCH;
+void snth_set_tone_lfo_wave(uint8_t tone, uint8_t lfo, uint8_t wave)
+{
+    assert(tone < MAXTONE);
+    assert(lfo  < MAXLFO);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].lfo[lfo].wave = wave;
+        snth_set_tone_lfo_cache(snth_curr_patch(), tone, lfo);
+        snth_give_edit();
+    }
+}
 
-    if (t->lfo[0].pan   != DEF_LFO_PAN ||
-        t->lfo[1].pan   != DEF_LFO_PAN) f |= FL_PAN;
+void snth_set_tone_lfo_sync(uint8_t tone, uint8_t lfo, uint8_t sync)
+{
+    assert(tone < MAXTONE);
+    assert(lfo  < MAXLFO);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].lfo[lfo].sync = sync;
+        snth_set_tone_lfo_cache(snth_curr_patch(), tone, lfo);
+        snth_give_edit();
+    }
+}
 
-    if (t->filter_mode != DEF_TONE_FILTER_MODE ||
-        t->filter_cut  != DEF_TONE_FILTER_CUT  ||
-        t->filter_res  != DEF_TONE_FILTER_RES  ||
-        t->filter_key  != DEF_TONE_FILTER_KEY  || f & FL_ENV2) f |= FL_FILTER;
+void snth_set_tone_lfo_rate(uint8_t tone, uint8_t lfo, uint8_t rate)
+{
+    assert(tone < MAXTONE);
+    assert(lfo  < MAXLFO);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].lfo[lfo].rate = rate;
+        snth_set_tone_lfo_cache(snth_curr_patch(), tone, lfo);
+        snth_give_edit();
+    }
+}
 
-    t->flags = f;
+void snth_set_tone_lfo_delay(uint8_t tone, uint8_t lfo, uint8_t delay)
+{
+    assert(tone < MAXTONE);
+    assert(lfo  < MAXLFO);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].lfo[lfo].delay = delay;
+        snth_set_tone_lfo_cache(snth_curr_patch(), tone, lfo);
+        snth_give_edit();
+    }
 }
 
-void snth_set_tone_wave(uint8_t tone, uint8_t wave)
+void snth_set_tone_lfo_level(uint8_t tone, uint8_t lfo, uint8_t level)
 {
     assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].wave = wave;
+    assert(lfo  < MAXLFO);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].lfo[lfo].level = level;
+        snth_set_tone_lfo_cache(snth_curr_patch(), tone, lfo);
+        snth_give_edit();
+    }
 }
 
-void snth_set_tone_mode(uint8_t tone, uint8_t mode)
+void snth_set_tone_lfo_pan(uint8_t tone, uint8_t lfo, uint8_t pan)
 {
     assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].mode = mode;
+    assert(lfo  < MAXLFO);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].lfo[lfo].pan = pan;
+        snth_set_tone_lfo_cache(snth_curr_patch(), tone, lfo);
+        snth_give_edit();
+    }
 }
 
-void snth_set_tone_level(uint8_t tone, uint8_t level)
+void snth_set_tone_lfo_pitch(uint8_t tone, uint8_t lfo, uint8_t pitch)
 {
     assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].level = level;
+    assert(lfo  < MAXLFO);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].lfo[lfo].pitch = pitch;
+        snth_set_tone_lfo_cache(snth_curr_patch(), tone, lfo);
+        snth_give_edit();
+    }
 }
 
-void snth_set_tone_pan(uint8_t tone, uint8_t pan)
+void snth_set_tone_lfo_phase(uint8_t tone, uint8_t lfo, uint8_t phase)
 {
     assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].pan = pan;
+    assert(lfo  < MAXLFO);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].lfo[lfo].phase = phase;
+        snth_set_tone_lfo_cache(snth_curr_patch(), tone, lfo);
+        snth_give_edit();
+    }
 }
 
-void snth_set_tone_delay(uint8_t tone, uint8_t delay)
+void snth_set_tone_lfo_filter(uint8_t tone, uint8_t lfo, uint8_t filter)
 {
     assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].delay = delay;
+    assert(lfo  < MAXLFO);
+    if (snth_take_edit())
+    {
+        edit[snth_curr_patch()].tone[tone].lfo[lfo].filter = filter;
+        snth_set_tone_lfo_cache(snth_curr_patch(), tone, lfo);
+        snth_give_edit();
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* Patch versions                                                            */
+
+static int snth_quiet(unsigned epoch)
+{
+    int busy;
+
+    /* Note whether the renderer has let go of all it saw at the epoch.   */
+    /* The audio thread itself holds nothing between its events.          */
+
+    if (render_self)
+        return 1;
+
+    busy = render_busy;
+    __sync_synchronize();
+
+    return (busy == 0 || render_epoch != epoch);
+}
+
+static uint16_t snth_new_version(void)
+{
+    static int k = 0;
+    int i;
+
+    /* Wait for the renderer to release a version, as needed.  A voice   */
+    /* may take a reference until the renderer is quiet, so count the    */
+    /* references only after.  The renderer itself cannot wait for its   */
+    /* own voices, and gives no version instead.                         */
+
+    while (1)
+    {
+        for (i = 0; i < MAXVERSION; ++i, k = (k + 1) % MAXVERSION)
+        {
+            if (patch_used[k] == VERSION_FREE)
+                return (uint16_t) k;
+
+            if (patch_used[k] == VERSION_GONE && snth_quiet(patch_gone[k]))
+            {
+                __sync_synchronize();
+
+                if (patch_refs[k] == 0)
+                {
+                    patch_used[k] = VERSION_FREE;
+                    return (uint16_t) k;
+                }
+            }
+        }
+
+        if (render_self)
+            return NO_VERSION;
+
+        sched_yield();
+    }
+}
+
+static void snth_put_patches(void)
+{
+    uint16_t *curr = patch_curr;
+    uint16_t *next = (curr == patch_table[0]) ? patch_table[1]
+                                              : patch_table[0];
+    unsigned epoch;
+    int i;
+
+    /* Wait while the renderer still reads the table written last. */
+
+    while (1)
+    {
+        int busy = render_busy;
+        __sync_synchronize();
+
+        if (render_self || busy == 0 || render_table != next)
+            break;
+
+        sched_yield();
+    }
+
+    /* Copy each changed patch into a new version of the next table.  A */
+    /* patch given no version stays changed, to publish at a later edit. */
+
+    snth_enter_state();
+
+    memcpy(next, curr, MAXPATCH * sizeof (uint16_t));
+
+    for (i = 0; i < MAXPATCH; ++i)
+        if (edit_dirty[i])
+        {
+            const uint16_t v = snth_new_version();
+
+            if (v == NO_VERSION)
+                continue;
+
+            memcpy(patch_pool + v, edit + i, sizeof (struct snth_patch));
+
+            patch_used[v] = VERSION_CURR;
+            patch_id  [v] = (uint8_t) i;
+            next      [i] = v;
+        }
+
+    /* Publish the table only once it is complete. */
+
+    __sync_synchronize();
+
+    patch_curr = next;
+
+    if (render_self)
+        render_table = next;
+
+    __sync_synchronize();
+
+    epoch = render_epoch;
+
+    /* Retire each replaced version. */
+
+    for (i = 0; i < MAXPATCH; ++i)
+        if (edit_dirty[i] && curr[i] != next[i])
+        {
+            if (curr[i] != NO_VERSION)
+            {
+                patch_used[curr[i]] = VERSION_GONE;
+                patch_gone[curr[i]] = epoch;
+            }
+            edit_dirty[i] = 0;
+        }
+
+    snth_leave_state();
+}
+
+static void snth_init_versions(void)
+{
+    memset((void *) patch_refs, 0, sizeof (patch_refs));
+    memset(patch_used, 0, sizeof (patch_used));
+
+    memset(patch_table, 0xFF, sizeof (patch_table));
+
+    patch_curr   = patch_table[0];
+    render_table = patch_table[0];
+}
+
+void snth_set_follow(int f)
+{
+    patch_follow = f;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Bulk edits                                                                */
+
+/* During a bulk edit, setters only mark the patches they change.  The       */
+/* commit recomputes each of their caches once and publishes them all in a   */
+/* single table.  Bulk edits nest, and hold the edit bank until the last     */
+/* commit.                                                                   */
+
+void snth_begin(void)
+{
+    if (snth_take_edit())
+        edit_depth++;
+}
+
+void snth_commit(void)
+{
+    int i;
+    int j;
+    int k;
+
+    /* A begin that could not take the edit bank began nothing. */
+
+    if (edit_held == 0 || edit_depth == 0)
+        return;
+
+    if (--edit_depth > 0)
+    {
+        snth_give_edit();
+        return;
+    }
+
+    for (i = 0; i < MAXPATCH; ++i)
+        if (edit_dirty[i])
+            for (j = 0; j < MAXTONE; ++j)
+            {
+                for (k = 0; k < MAXENV; ++k)
+                    snth_set_env_cache(edit[i].tone[j].env + k);
+                for (k = 0; k < MAXLFO; ++k)
+                    snth_set_lfo_cache(edit[i].tone[j].lfo + k);
+
+                snth_set_tone_flags((uint8_t) i, (uint8_t) j);
+            }
+
+    snth_put_patches();
+    snth_give_edit();
+}
+
+/*===========================================================================*/
+
+uint8_t snth_get_channel(void)
+{
+    return curr_chan;
 }
 
-void snth_set_tone_pitch_coarse(uint8_t tone, uint8_t pitch_coarse)
+uint8_t snth_get_patch(void)
 {
-    assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].pitch_coarse = pitch_coarse;
+    return channel[curr_chan].patch;
 }
 
-void snth_set_tone_pitch_fine(uint8_t tone, uint8_t pitch_fine)
+uint8_t snth_get_bank(void)
 {
-    assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].pitch_fine = pitch_fine;
+    return channel[curr_chan].bank;
 }
 
-void snth_set_tone_pitch_env(uint8_t tone, uint8_t pitch_env)
+/*---------------------------------------------------------------------------*/
+
+uint8_t snth_get_channel_level(void)
 {
-    assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].pitch_env = pitch_env;
-    snth_set_tone_cache(channel[curr_chan].patch, tone);
+    return channel[curr_chan].level;
 }
 
-void snth_set_tone_filter_mode(uint8_t tone, uint8_t filter_mode)
+uint8_t snth_get_channel_pan(void)
 {
-    assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].filter_mode = filter_mode;
-    snth_set_tone_cache(channel[curr_chan].patch, tone);
+    return channel[curr_chan].pan;
 }
 
-void snth_set_tone_filter_cut(uint8_t tone, uint8_t filter_cut)
+uint8_t snth_get_channel_reverb(void)
 {
-    assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].filter_cut = filter_cut;
-    snth_set_tone_cache(channel[curr_chan].patch, tone);
+    return channel[curr_chan].reverb;
 }
 
-void snth_set_tone_filter_res(uint8_t tone, uint8_t filter_res)
+uint8_t snth_get_channel_chorus(void)
 {
-    assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].filter_res = filter_res;
-    snth_set_tone_cache(channel[curr_chan].patch, tone);
+    return channel[curr_chan].chorus;
 }
 
-void snth_set_tone_filter_env(uint8_t tone, uint8_t filter_env)
+uint8_t snth_get_channel_eq_low(void)
 {
-    assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].filter_env = filter_env;
-    snth_set_tone_cache(channel[curr_chan].patch, tone);
+    return channel[curr_chan].eq_low;
 }
 
-void snth_set_tone_filter_key(uint8_t tone, uint8_t filter_key)
+uint8_t snth_get_channel_eq_mid(void)
 {
-    assert(tone < MAXTONE);
-    patch[channel[curr_chan].patch].tone[tone].filter_key = filter_key;
-    snth_set_tone_cache(channel[curr_chan].patch, tone);
+    return channel[curr_chan].eq_mid;
 }
 
-/*---------------------------------------------------------------------------*/
-
-static void snth_set_tone_env_cache(uint8_t i, uint8_t j, uint8_t k)
+uint8_t snth_get_channel_eq_freq(void)
 {
-    struct snth_env *e = patch[i].tone[j].env + k;
-
-    float at = TO_DT(e->a);
-    float dt = TO_DT(e->d);
-    float sb = TO_01(e->s);
-    float rt = TO_DT(e->r);
-
-    /* Recompute the envelope state cache. */
-
-    if (at > 0)
-    {
-        e->am = 1 / at;
-        e->ab = 0;
-    }
-    else
-    {
-        e->am = 0;
-        e->ab = 1;
-    }
-
-    if (dt > 0)
-    {
-        e->dm =         -(1 - sb) / dt;
-        e->db = 1 + at * (1 - sb) / dt;
-    }
-    else
-    {
-        e->dm = 0;
-        e->db = sb;
-    }
-
-    if (rt > 0)
-    {
-        e->rm = -sb / rt;
-        e->rb = 0;
-    }
-    else
-    {
-        e->rm = 0;
-        e->rb = 0;
-    }
-
-    e->sb = sb;
-
-    e->flags = (uint16_t) (e->a || e->d || e->s || e->r);
-
-    snth_set_tone_cache(i, j);
+    return channel[curr_chan].eq_freq;
 }
 
-void snth_set_tone_env_a(uint8_t tone, uint8_t env, uint8_t a)
+uint8_t snth_get_channel_eq_high(void)
 {
-    assert(tone < MAXTONE);
-    assert(env  < MAXENV);
-    patch[channel[curr_chan].patch].tone[tone].env[env].a = a;
-    snth_set_tone_env_cache(channel[curr_chan].patch, tone, env);
+    return channel[curr_chan].eq_high;
 }
 
-void snth_set_tone_env_d(uint8_t tone, uint8_t env, uint8_t d)
+uint8_t snth_get_channel_drive(void)
 {
-    assert(tone < MAXTONE);
-    assert(env  < MAXENV);
-    patch[channel[curr_chan].patch].tone[tone].env[env].d = d;
-    snth_set_tone_env_cache(channel[curr_chan].patch, tone, env);
+    return channel[curr_chan].drive;
 }
 
-void snth_set_tone_env_s(uint8_t tone, uint8_t env, uint8_t s)
+uint8_t snth_get_channel_azimuth(void)
 {
-    assert(tone < MAXTONE);
-    assert(env  < MAXENV);
-    patch[channel[curr_chan].patch].tone[tone].env[env].s = s;
-    snth_set_tone_env_cache(channel[curr_chan].patch, tone, env);
+    return channel[curr_chan].azimuth;
 }
 
-void snth_set_tone_env_r(uint8_t tone, uint8_t env, uint8_t r)
+uint8_t snth_get_channel_elevation(void)
 {
-    assert(tone < MAXTONE);
-    assert(env  < MAXENV);
-    patch[channel[curr_chan].patch].tone[tone].env[env].r = r;
-    snth_set_tone_env_cache(channel[curr_chan].patch, tone, env);
+    return channel[curr_chan].elevation;
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void snth_set_tone_lfo_cache(uint8_t i, uint8_t j, uint8_t k)
+int snth_get_layout(void)
 {
-    struct snth_lfo *l = patch[i].tone[j].lfo + k;
-
-    float rt = TO_DT(l->rate);
-    float dt = TO_DT(l->delay);
-
-    l->freq = (rt > 0) ? (float) rate / rt : 0;
-    l->dm   = (dt > 0) ? (float) 1.0f / dt : 0;
-
-    l->flags = (uint16_t) ((l->rate > 0) && (l->level  != DEF_LFO_LEVEL ||
-                                             l->pan    != DEF_LFO_PAN   ||
-                                             l->pitch  != DEF_LFO_PITCH ||
-                                             l->phase  != DEF_LFO_PHASE ||
-                                             l->filter != DEF_LFO_FILTER));
-    snth_set_tone_cache(i, j);
+    return layout;
 }
 
-void snth_set_tone_lfo_wave(uint8_t tone, uint8_t lfo, uint8_t wave)
+int snth_get_speakers(void)
 {
-    assert(tone < MAXTONE);
-    assert(lfo  < MAXLFO);
-    patch[channel[curr_chan].patch].tone[tone].lfo[lfo].wave = wave;
-    snth_set_tone_lfo_cache(channel[curr_chan].patch, tone, lfo);
+    return layouts[layout].n;
 }
 
-void snth_set_tone_lfo_sync(uint8_t tone, uint8_t lfo, uint8_t sync)
+/*---------------------------------------------------------------------------*/
+
+uint8_t snth_get_reverb_level(void)
 {
-    assert(tone < MAXTONE);
-    assert(lfo  < MAXLFO);
-    patch[channel[curr_chan].patch].tone[tone].lfo[lfo].sync = sync;
-    snth_set_tone_lfo_cache(channel[curr_chan].patch, tone, lfo);
+    return reverb.level;
 }
 
-void snth_set_tone_lfo_rate(uint8_t tone, uint8_t lfo, uint8_t rate)
+uint8_t snth_get_reverb_time(void)
 {
-    assert(tone < MAXTONE);
-    assert(lfo  < MAXLFO);
-    patch[channel[curr_chan].patch].tone[tone].lfo[lfo].rate = rate;
-    snth_set_tone_lfo_cache(channel[curr_chan].patch, tone, lfo);
+    return reverb.time;
 }
 
-void snth_set_tone_lfo_delay(uint8_t tone, uint8_t lfo, uint8_t delay)
+uint8_t snth_get_reverb_damp(void)
 {
-    assert(tone < MAXTONE);
-    assert(lfo  < MAXLFO);
-    patch[channel[curr_chan].patch].tone[tone].lfo[lfo].delay = delay;
-    snth_set_tone_lfo_cache(channel[curr_chan].patch, tone, lfo);
+    return reverb.damp;
 }
 
-void snth_set_tone_lfo_level(uint8_t tone, uint8_t lfo, uint8_t level)
+uint8_t snth_get_reverb_size(void)
 {
-    assert(tone < MAXTONE);
-    assert(lfo  < MAXLFO);
-    patch[channel[curr_chan].patch].tone[tone].lfo[lfo].level = level;
-    snth_set_tone_lfo_cache(channel[curr_chan].patch, tone, lfo);
+    return reverb.size;
 }
 
-void snth_set_tone_lfo_pan(uint8_t tone, uint8_t lfo, uint8_t pan)
+/*---------------------------------------------------------------------------*/
+
+uint8_t snth_get_chorus_level(void)
 {
-    assert(tone < MAXTONE);
-    assert(lfo  < MAXLFO);
-    patch[channel[curr_chan].patch].tone[tone].lfo[lfo].pan = pan;
-    snth_set_tone_lfo_cache(channel[curr_chan].patch, tone, lfo);
+    return chorus.level;
 }
 
-void snth_set_tone_lfo_pitch(uint8_t tone, uint8_t lfo, uint8_t pitch)
+uint8_t snth_get_chorus_rate(void)
 {
-    assert(tone < MAXTONE);
-    assert(lfo  < MAXLFO);
-    patch[channel[curr_chan].patch].tone[tone].lfo[lfo].pitch = pitch;
-    snth_set_tone_lfo_cache(channel[curr_chan].patch, tone, lfo);
+    return chorus.rate;
 }
 
-void snth_set_tone_lfo_phase(uint8_t tone, uint8_t lfo, uint8_t phase)
+uint8_t snth_get_chorus_depth(void)
 {
-    assert(tone < MAXTONE);
-    assert(lfo  < MAXLFO);
-    patch[channel[curr_chan].patch].tone[tone].lfo[lfo].phase = phase;
-    snth_set_tone_lfo_cache(channel[curr_chan].patch, tone, lfo);
+    return chorus.depth;
 }
 
-void snth_set_tone_lfo_filter(uint8_t tone, uint8_t lfo, uint8_t filter)
+uint8_t snth_get_chorus_delay(void)
 {
-    assert(tone < MAXTONE);
-    assert(lfo  < MAXLFO);
-    patch[channel[curr_chan].patch].tone[tone].lfo[lfo].filter = filter;
-    snth_set_tone_lfo_cache(channel[curr_chan].patch, tone, lfo);
+    return chorus.delay;
 }
 
-/*===========================================================================*/
-
-uint8_t snth_get_channel(void)
+uint8_t snth_get_limiter_level(void)
 {
-    return curr_chan;
+    return limiter.level;
 }
 
-uint8_t snth_get_patch(void)
+uint8_t snth_get_limiter_release(void)
 {
-    return channel[curr_chan].patch;
+    return limiter.release;
 }
 
-uint8_t snth_get_bank(void)
+uint8_t snth_get_smooth_time(void)
 {
-    return 0;
+    return smooth_time;
 }
 
 /*---------------------------------------------------------------------------*/
 
 const char *snth_get_patch_name(void)
 {
-    return patch[channel[curr_chan].patch].name;
+    return edit[snth_curr_patch()].name;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -1740,79 +4902,79 @@ const char *snth_get_patch_name(void)
 uint8_t snth_get_tone_wave(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].wave;
+    return edit[snth_curr_patch()].tone[tone].wave;
 }
 
 uint8_t snth_get_tone_mode(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].mode;
+    return edit[snth_curr_patch()].tone[tone].mode;
 }
 
 uint8_t snth_get_tone_level(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].level;
+    return edit[snth_curr_patch()].tone[tone].level;
 }
 
 uint8_t snth_get_tone_pan(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].pan;
+    return edit[snth_curr_patch()].tone[tone].pan;
 }
 
 uint8_t snth_get_tone_delay(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].delay;
+    return edit[snth_curr_patch()].tone[tone].delay;
 }
 
 uint8_t snth_get_tone_pitch_coarse(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].pitch_coarse;
+    return edit[snth_curr_patch()].tone[tone].pitch_coarse;
 }
 
 uint8_t snth_get_tone_pitch_fine(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].pitch_fine;
+    return edit[snth_curr_patch()].tone[tone].pitch_fine;
 }
 
 uint8_t snth_get_tone_pitch_env(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].pitch_env;
+    return edit[snth_curr_patch()].tone[tone].pitch_env;
 }
 
 uint8_t snth_get_tone_filter_mode(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].filter_mode;
+    return edit[snth_curr_patch()].tone[tone].filter_mode;
 }
 
 uint8_t snth_get_tone_filter_cut(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].filter_cut;
+    return edit[snth_curr_patch()].tone[tone].filter_cut;
 }
 
 uint8_t snth_get_tone_filter_res(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].filter_res;
+    return edit[snth_curr_patch()].tone[tone].filter_res;
 }
 
 uint8_t snth_get_tone_filter_env(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].filter_env;
+    return edit[snth_curr_patch()].tone[tone].filter_env;
 }
 
 uint8_t snth_get_tone_filter_key(uint8_t tone)
 {
     assert(tone < MAXTONE);
-    return patch[channel[curr_chan].patch].tone[tone].filter_key;
+    return edit[snth_curr_patch()].tone[tone].filter_key;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -1821,28 +4983,28 @@ uint8_t snth_get_tone_env_a(uint8_t tone, uint8_t env)
 {
     assert(tone < MAXTONE);
     assert(env  < MAXENV);
-    return patch[channel[curr_chan].patch].tone[tone].env[env].a;
+    return edit[snth_curr_patch()].tone[tone].env[env].a;
 }
 
 uint8_t snth_get_tone_env_d(uint8_t tone, uint8_t env)
 {
     assert(tone < MAXTONE);
     assert(env  < MAXENV);
-    return patch[channel[curr_chan].patch].tone[tone].env[env].d;
+    return edit[snth_curr_patch()].tone[tone].env[env].d;
 }
 
 uint8_t snth_get_tone_env_s(uint8_t tone, uint8_t env)
 {
     assert(tone < MAXTONE);
     assert(env  < MAXENV);
-    return patch[channel[curr_chan].patch].tone[tone].env[env].s;
+    return edit[snth_curr_patch()].tone[tone].env[env].s;
 }
 
 uint8_t snth_get_tone_env_r(uint8_t tone, uint8_t env)
 {
     assert(tone < MAXTONE);
     assert(env  < MAXENV);
-    return patch[channel[curr_chan].patch].tone[tone].env[env].r;
+    return edit[snth_curr_patch()].tone[tone].env[env].r;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -1851,63 +5013,170 @@ uint8_t snth_get_tone_lfo_wave(uint8_t tone, uint8_t lfo)
 {
     assert(tone < MAXTONE);
     assert(lfo  < MAXLFO);
-    return patch[channel[curr_chan].patch].tone[tone].lfo[lfo].wave;
+    return edit[snth_curr_patch()].tone[tone].lfo[lfo].wave;
 }
 
 uint8_t snth_get_tone_lfo_sync(uint8_t tone, uint8_t lfo)
 {
     assert(tone < MAXTONE);
     assert(lfo  < MAXLFO);
-    return patch[channel[curr_chan].patch].tone[tone].lfo[lfo].sync;
+    return edit[snth_curr_patch()].tone[tone].lfo[lfo].sync;
 }
 
 uint8_t snth_get_tone_lfo_rate(uint8_t tone, uint8_t lfo)
 {
     assert(tone < MAXTONE);
     assert(lfo  < MAXLFO);
-    return patch[channel[curr_chan].patch].tone[tone].lfo[lfo].rate;
+    return edit[snth_curr_patch()].tone[tone].lfo[lfo].rate;
 }
 
 uint8_t snth_get_tone_lfo_delay(uint8_t tone, uint8_t lfo)
 {
     assert(tone < MAXTONE);
     assert(lfo  < MAXLFO);
-    return patch[channel[curr_chan].patch].tone[tone].lfo[lfo].delay;
+    return edit[snth_curr_patch()].tone[tone].lfo[lfo].delay;
 }
 
 uint8_t snth_get_tone_lfo_level(uint8_t tone, uint8_t lfo)
 {
     assert(tone < MAXTONE);
     assert(lfo  < MAXLFO);
-    return patch[channel[curr_chan].patch].tone[tone].lfo[lfo].level;
+    return edit[snth_curr_patch()].tone[tone].lfo[lfo].level;
 }
 
 uint8_t snth_get_tone_lfo_pan(uint8_t tone, uint8_t lfo)
 {
     assert(tone < MAXTONE);
     assert(lfo  < MAXLFO);
-    return patch[channel[curr_chan].patch].tone[tone].lfo[lfo].pan;
+    return edit[snth_curr_patch()].tone[tone].lfo[lfo].pan;
 }
 
 uint8_t snth_get_tone_lfo_pitch(uint8_t tone, uint8_t lfo)
 {
     assert(tone < MAXTONE);
     assert(lfo  < MAXLFO);
-    return patch[channel[curr_chan].patch].tone[tone].lfo[lfo].pitch;
+    return edit[snth_curr_patch()].tone[tone].lfo[lfo].pitch;
 }
 
 uint8_t snth_get_tone_lfo_phase(uint8_t tone, uint8_t lfo)
 {
     assert(tone < MAXTONE);
     assert(lfo  < MAXLFO);
-    return patch[channel[curr_chan].patch].tone[tone].lfo[lfo].phase;
+    return edit[snth_curr_patch()].tone[tone].lfo[lfo].phase;
 }
 
 uint8_t snth_get_tone_lfo_filter(uint8_t tone, uint8_t lfo)
 {
     assert(tone < MAXTONE);
     assert(lfo  < MAXLFO);
-    return patch[channel[curr_chan].patch].tone[tone].lfo[lfo].filter;
+    return edit[snth_curr_patch()].tone[tone].lfo[lfo].filter;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void snth_copy_state(struct snth_state *S)
+{
+    const struct snth_channel *C = channel + curr_chan;
+    const struct snth_patch   *P = patch_pool + patch_curr[C->patch];
+
+    int i;
+    int j;
+
+    S->channel           = curr_chan;
+    S->patch             = C->patch;
+    S->bank              = C->bank;
+
+    S->channel_level     = C->level;
+    S->channel_pan       = C->pan;
+    S->channel_reverb    = C->reverb;
+    S->channel_chorus    = C->chorus;
+    S->channel_eq_low    = C->eq_low;
+    S->channel_eq_mid    = C->eq_mid;
+    S->channel_eq_freq   = C->eq_freq;
+    S->channel_eq_high   = C->eq_high;
+    S->channel_drive     = C->drive;
+    S->channel_azimuth   = C->azimuth;
+    S->channel_elevation = C->elevation;
+
+    S->reverb_level      = reverb.level;
+    S->reverb_time       = reverb.time;
+    S->reverb_damp       = reverb.damp;
+    S->reverb_size       = reverb.size;
+    S->chorus_level      = chorus.level;
+    S->chorus_rate       = chorus.rate;
+    S->chorus_depth      = chorus.depth;
+    S->chorus_delay      = chorus.delay;
+    S->limiter_level     = limiter.level;
+    S->limiter_release   = limiter.release;
+    S->smooth_time       = smooth_time;
+
+    memcpy(S->patch_name, P->name, MAXSTR);
+
+    for (i = 0; i < MAXTONE; ++i)
+    {
+        const struct snth_tone *T = P->tone + i;
+        struct snth_state_tone *U = S->tone + i;
+
+        U->wave         = T->wave;
+        U->mode         = T->mode;
+        U->level        = T->level;
+        U->pan          = T->pan;
+        U->delay        = T->delay;
+        U->pitch_coarse = T->pitch_coarse;
+        U->pitch_fine   = T->pitch_fine;
+        U->pitch_env    = T->pitch_env;
+        U->filter_mode  = T->filter_mode;
+        U->filter_cut   = T->filter_cut;
+        U->filter_res   = T->filter_res;
+        U->filter_env   = T->filter_env;
+        U->filter_key   = T->filter_key;
+
+        for (j = 0; j < MAXENV; ++j)
+        {
+            U->env[j].a = T->env[j].a;
+            U->env[j].d = T->env[j].d;
+            U->env[j].s = T->env[j].s;
+            U->env[j].r = T->env[j].r;
+        }
+        for (j = 0; j < MAXLFO; ++j)
+        {
+            U->lfo[j].wave   = T->lfo[j].wave;
+            U->lfo[j].sync   = T->lfo[j].sync;
+            U->lfo[j].rate   = T->lfo[j].rate;
+            U->lfo[j].delay  = T->lfo[j].delay;
+            U->lfo[j].level  = T->lfo[j].level;
+            U->lfo[j].pan    = T->lfo[j].pan;
+            U->lfo[j].pitch  = T->lfo[j].pitch;
+            U->lfo[j].phase  = T->lfo[j].phase;
+            U->lfo[j].filter = T->lfo[j].filter;
+        }
+    }
+}
+
+unsigned snth_get_state(struct snth_state *S)
+{
+    unsigned b;
+    unsigned e;
+
+    /* Copy the state, retrying if any change overlapped the copy. */
+
+    while (1)
+    {
+        e = state_end;
+        __sync_synchronize();
+
+        snth_copy_state(S);
+
+        __sync_synchronize();
+        b = state_begin;
+
+        if (b == e)
+            break;
+
+        sched_yield();
+    }
+
+    return (S->version = e);
 }
 
 /*===========================================================================*/
@@ -1932,20 +5201,26 @@ static void snth_osc_on(struct snth_osc *O, const struct snth_lfo *L)
     O->lfo_phase[0] = (L[0].sync) ? 0 : FRAC(curr_time * L[0].freq / rate);
     O->lfo_phase[1] = (L[1].sync) ? 0 : FRAC(curr_time * L[1].freq / rate);
 
-    /* Initialize the filter. */
+    /* Initialize the filter, and snap smoothed parameters at first use. */
 
     memset(&O->filter, 0, sizeof (struct snth_filter));
+
+    O->ramp = 0;
 }
 
 static void snth_osc_off(struct snth_osc *O, const struct snth_env *E)
 {
+    /* Release at the event time, which may fall within the next vector. */
+
+    const int t = O->time + ((note_time > curr_time) ? note_time - curr_time
+                                                     : 0);
     int i;
 
     for (i = 0; i < MAXENV; ++i)
         if (E[i].rm < 0)
         {
             O->rm[i] = E[i].rm;
-            O->rb[i] = E[i].sb - E[i].rm * O->time;
+            O->rb[i] = E[i].sb - E[i].rm * t;
         }
         else
         {
@@ -1954,57 +5229,228 @@ static void snth_osc_off(struct snth_osc *O, const struct snth_env *E)
         }
 }
 
-/*---------------------------------------------------------------------------*/
+/*---------------------------------------------------------------------------*/
+
+void snth_note_on(uint8_t chan, uint8_t pitch, uint8_t level)
+{
+    assert(chan  < MAXCHANNEL);
+    assert(pitch < 128);
+
+    struct snth_note *N = note + curr_note;
+    const struct snth_tone *T;
+
+    channel[chan].note[pitch] = curr_note;
+
+    /* Take a reference to the current version of the channel's patch, */
+    /* releasing any held by a note this one replaces.                 */
+
+    snth_note_free(N);
+
+    N->version = snth_curr_table()[channel[chan].patch];
+    patch_refs[N->version]++;
+
+    T = patch_pool[N->version].tone;
+
+    /* Initialize a new note. */
+
+    N->start = (note_time > curr_time) ? note_time : curr_time;
+    N->pitch = pitch;
+    N->level = level;
+    N->chan  = chan;
+    N->press = 0;
+    N->held  = 0;
+
+    /* Initialize an oscillator for each active tone of this patch. */
+
+    if (T[0].mode) snth_osc_on(N->osc + 0, T[0].lfo);
+    if (T[1].mode) snth_osc_on(N->osc + 1, T[1].lfo);
+    if (T[2].mode) snth_osc_on(N->osc + 2, T[2].lfo);
+    if (T[3].mode) snth_osc_on(N->osc + 3, T[3].lfo);
+
+    /* Advance the note ring index. */
+
+    curr_note = (uint16_t) ((curr_note + 1) % MAXNOTE);
+}
+
+static void snth_note_release(struct snth_note *N)
+{
+    const struct snth_tone *T;
+
+    if (N->version == NO_VERSION)
+        return;
+
+    /* Stop all oscillators currently playing this note. */
+
+    T = snth_note_tone(N);
+
+    snth_osc_off(N->osc + 0, T[0].env);
+    snth_osc_off(N->osc + 1, T[1].env);
+    snth_osc_off(N->osc + 2, T[2].env);
+    snth_osc_off(N->osc + 3, T[3].env);
+
+    N->held = 0;
+}
+
+void snth_note_off(uint8_t chan, uint8_t pitch, uint8_t level)
+{
+    assert(chan  < MAXCHANNEL);
+    assert(pitch < 128);
+
+    /* If there is in fact a note playing, release it or hold it. */
+
+    if (channel[chan].note[pitch] != NO_NOTE)
+    {
+        struct snth_note *N = note + channel[chan].note[pitch];
+
+        if (channel[chan].mod_sustain < 64)
+            snth_note_release(N);
+        else
+            N->held = 1;
+    }
+
+    channel[chan].note[pitch] = NO_NOTE;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void snth_set_mod_cache(uint8_t chan)
+{
+    struct snth_channel *C = channel + chan;
+
+    /* Bend by the RPN 0 range.  Scale by volume and expression on a       */
+    /* squared law.  Wheel and pressure each give a semitone of vibrato.   */
+
+    C->mb = (C->mod_bend - 8192) * C->mod_range / 8192.0f;
+    C->mv = TO_01(C->mod_wheel) + TO_01(C->mod_pressure);
+    C->mk = TO_01(C->mod_volume)     * TO_01(C->mod_volume)
+          * TO_01(C->mod_expression) * TO_01(C->mod_expression);
+    C->mp = TO_11(C->mod_pan);
+}
+
+static void snth_init_mod(uint8_t chan)
+{
+    struct snth_channel *C = channel + chan;
+
+    /* Reset all controllers, leaving volume, pan, and bank in place. */
+
+    C->mod_bend       = 8192;
+    C->mod_rpn        = 0x3FFF;
+    C->mod_wheel      = 0;
+    C->mod_expression = 127;
+    C->mod_pressure   = 0;
+
+    snth_set_mod_cache(chan);
+}
+
+static void snth_notes_off(uint8_t chan, int now)
+{
+    int i;
+
+    /* Release, or with now silence, all notes of the given channel. */
+
+    for (i = 0; i < MAXNOTE; ++i)
+        if (note[i].level && note[i].chan == chan)
+        {
+            if (now)
+                snth_note_free(note + i);
+            else
+                snth_note_release(note + i);
+        }
+
+    for (i = 0; i < 128; ++i)
+        channel[chan].note[i] = NO_NOTE;
+}
+
+void snth_control(uint8_t chan, uint8_t cc, uint8_t value)
+{
+    assert(chan < MAXCHANNEL);
+
+    struct snth_channel *C = channel + chan;
+
+    int i;
+
+    switch (cc)
+    {
+    case 0x00:
+        snth_enter_state();
+        C->bank = value;
+        snth_leave_state();
+        break;
+
+    case 0x01: C->mod_wheel      = value; break;
+    case 0x07: C->mod_volume     = value; break;
+    case 0x0A: C->mod_pan        = value; break;
+    case 0x0B: C->mod_expression = value; break;
+
+    case 0x06:
+
+        /* Data entry sets the pitch bend range when RPN 0 is selected. */
+
+        if (C->mod_rpn == 0)
+            C->mod_range = (value < 24) ? value : 24;
+        break;
+
+    case 0x40:
 
-void snth_note_on(uint8_t chan, uint8_t pitch, uint8_t level)
-{
-    assert(chan  < MAXCHANNEL);
-    assert(pitch < 128);
+        /* Releasing the sustain pedal releases all held notes. */
 
-    struct snth_tone *T = patch[channel[chan].patch].tone;
-    struct snth_note *N = note + curr_note;
+        if (C->mod_sustain >= 64 && value < 64)
+            for (i = 0; i < MAXNOTE; ++i)
+                if (note[i].level && note[i].chan == chan && note[i].held)
+                    snth_note_release(note + i);
 
-    channel[chan].note[pitch] = curr_note;
+        C->mod_sustain = value;
+        break;
 
-    /* Initialize a new note. */
+    case 0x64: C->mod_rpn = (C->mod_rpn & 0x3F80) | value;        break;
+    case 0x65: C->mod_rpn = (C->mod_rpn & 0x007F) | (value << 7); break;
 
-    N->start = curr_time;
-    N->pitch = pitch;
-    N->level = level;
-    N->chan  = chan;
+    case 0x78: snth_notes_off(chan, 1); break;
+    case 0x79:
+        snth_control(chan, 0x40, 0);
+        snth_init_mod(chan);
+        break;
+    case 0x7B: snth_notes_off(chan, 0); break;
+    }
 
-    /* Initialize an oscillator for each active tone of this patch. */
+    snth_set_mod_cache(chan);
+}
 
-    if (T[0].mode) snth_osc_on(N->osc + 0, T[0].lfo);
-    if (T[1].mode) snth_osc_on(N->osc + 1, T[1].lfo);
-    if (T[2].mode) snth_osc_on(N->osc + 2, T[2].lfo);
-    if (T[3].mode) snth_osc_on(N->osc + 3, T[3].lfo);
+void snth_program(uint8_t chan, uint8_t program)
+{
+    assert(chan < MAXCHANNEL);
 
-    /* Advance the note ring index. */
+    /* There is only one bank of patches, so the channel's bank is kept */
+    /* but does not select among them.                                  */
 
-    curr_note = (uint16_t) ((curr_note + 1) % MAXNOTE);
+    snth_enter_state();
+    channel[chan].patch = (uint8_t) (program % MAXPATCH);
+    snth_leave_state();
 }
 
-void snth_note_off(uint8_t chan, uint8_t pitch, uint8_t level)
+void snth_bend(uint8_t chan, uint16_t bend)
 {
-    assert(chan  < MAXCHANNEL);
-    assert(pitch < 128);
+    assert(chan < MAXCHANNEL);
 
-    struct snth_tone *T = patch[channel[chan].patch].tone;
+    channel[chan].mod_bend = bend & 0x3FFF;
+    snth_set_mod_cache(chan);
+}
 
-    /* If there is in fact a note playing... */
+void snth_pressure(uint8_t chan, uint8_t value)
+{
+    assert(chan < MAXCHANNEL);
 
-    if (channel[chan].note[pitch] != NO_NOTE)
-    {
-        /* Stop all oscillators currently playing this note. */
+    channel[chan].mod_pressure = value;
+    snth_set_mod_cache(chan);
+}
 
-        snth_osc_off(note[channel[chan].note[pitch]].osc + 0, T[0].env);
-        snth_osc_off(note[channel[chan].note[pitch]].osc + 1, T[1].env);
-        snth_osc_off(note[channel[chan].note[pitch]].osc + 2, T[2].env);
-        snth_osc_off(note[channel[chan].note[pitch]].osc + 3, T[3].env);
-    }
+void snth_touch(uint8_t chan, uint8_t pitch, uint8_t value)
+{
+    assert(chan  < MAXCHANNEL);
+    assert(pitch < 128);
 
-    channel[chan].note[pitch] = NO_NOTE;
+    if (channel[chan].note[pitch] != NO_NOTE)
+        note[channel[chan].note[pitch]].press = value;
 }
 
 /*===========================================================================*/
@@ -2012,7 +5458,7 @@ void snth_note_off(uint8_t chan, uint8_t pitch, uint8_t level)
 
 static int snth_stat_env(uint8_t i, uint8_t j, uint8_t k)
 {
-    const struct snth_env *e = patch[i].tone[j].env + k;
+    const struct snth_env *e = edit[i].tone[j].env + k;
 
     /* Indicate whether all parameters of an envelope have default state. */
 
@@ -2024,7 +5470,7 @@ static int snth_stat_env(uint8_t i, uint8_t j, uint8_t k)
 
 static int snth_stat_lfo(uint8_t i, uint8_t j, uint8_t k)
 {
-    const struct snth_lfo *l = patch[i].tone[j].lfo + k;
+    const struct snth_lfo *l = edit[i].tone[j].lfo + k;
 
     /* Indicate whether all parameters of an LFO have default state. */
 
@@ -2041,7 +5487,7 @@ static int snth_stat_lfo(uint8_t i, uint8_t j, uint8_t k)
 
 static int snth_stat_tone(uint8_t i, uint8_t j)
 {
-    const struct snth_tone *t = patch[i].tone + j;
+    const struct snth_tone *t = edit[i].tone + j;
 
     uint8_t def_tone_mode = j ? DEF_TONE_MODE : SNTH_MODE_MIX;
 
@@ -2064,6 +5510,47 @@ static int snth_stat_tone(uint8_t i, uint8_t j)
             (t->filter_key   != DEF_TONE_FILTER_KEY));
 }
 
+static int snth_stat_channel(uint8_t i)
+{
+    const struct snth_channel *h = channel + i;
+
+    /* Indicate whether all mixer parameters of a channel have default. */
+
+    return ((h->level  != DEF_CHANNEL_LEVEL)  ||
+            (h->pan    != DEF_CHANNEL_PAN)    ||
+            (h->reverb != DEF_CHANNEL_REVERB) ||
+            (h->chorus != DEF_CHANNEL_CHORUS) ||
+
+            (h->eq_low  != DEF_CHANNEL_EQ_LOW)  ||
+            (h->eq_mid  != DEF_CHANNEL_EQ_MID)  ||
+            (h->eq_freq != DEF_CHANNEL_EQ_FREQ) ||
+            (h->eq_high != DEF_CHANNEL_EQ_HIGH) ||
+            (h->drive   != DEF_CHANNEL_DRIVE)   ||
+
+            (h->azimuth   != DEF_CHANNEL_AZIMUTH) ||
+            (h->elevation != DEF_CHANNEL_ELEVATION));
+}
+
+static int snth_stat_effects(void)
+{
+    /* Indicate whether any effect parameter has non-default state. */
+
+    return ((reverb.level != DEF_REVERB_LEVEL) ||
+            (reverb.time  != DEF_REVERB_TIME)  ||
+            (reverb.damp  != DEF_REVERB_DAMP)  ||
+            (reverb.size  != DEF_REVERB_SIZE)  ||
+
+            (chorus.level != DEF_CHORUS_LEVEL) ||
+            (chorus.rate  != DEF_CHORUS_RATE)  ||
+            (chorus.depth != DEF_CHORUS_DEPTH) ||
+            (chorus.delay != DEF_CHORUS_DELAY) ||
+
+            (limiter.level   != DEF_LIMITER_LEVEL) ||
+            (limiter.release != DEF_LIMITER_RELEASE) ||
+
+            (smooth_time != DEF_SMOOTH_TIME));
+}
+
 static int snth_stat_patch(uint8_t i)
 {
     uint8_t j;
@@ -2071,7 +5558,7 @@ static int snth_stat_patch(uint8_t i)
 
     /* Indicate whether all parameters of a patch have default state. */
 
-    if (strcmp(patch[i].name, DEF_PATCH_NAME))
+    if (strcmp(edit[i].name, DEF_PATCH_NAME))
         return 1;
 
     for (j = 0; j < MAXTONE; ++j)
@@ -2131,7 +5618,7 @@ static size_t dump_val(uint8_t *p, size_t c, size_t n,
 static size_t dump_env(uint8_t *p, size_t c, size_t n,
                        uint8_t i, uint8_t j, uint8_t k)
 {
-    struct snth_env *e = patch[i].tone[j].env + k;
+    struct snth_env *e = edit[i].tone[j].env + k;
 
     uint8_t tt = (uint8_t) (j << 4);
     uint8_t ee = (uint8_t) (k << 2);
@@ -2149,7 +5636,7 @@ static size_t dump_env(uint8_t *p, size_t c, size_t n,
 static size_t dump_lfo(uint8_t *p, size_t c, size_t n,
                        uint8_t i, uint8_t j, uint8_t k)
 {
-    struct snth_lfo *l = patch[i].tone[j].lfo + k;
+    struct snth_lfo *l = edit[i].tone[j].lfo + k;
 
     uint8_t tt = (uint8_t) (j << 4);
     uint8_t ll = (uint8_t) (k << 3);
@@ -2173,7 +5660,7 @@ static size_t dump_lfo(uint8_t *p, size_t c, size_t n,
 
 static size_t dump_tone(uint8_t *p, size_t c, size_t n, uint8_t i, uint8_t j)
 {
-    struct snth_tone *t = patch[i].tone + j;
+    struct snth_tone *t = edit[i].tone + j;
     uint8_t          tt = (uint8_t) (j << 4);
 
     uint8_t def_tone_mode = j ? DEF_TONE_MODE : SNTH_MODE_MIX;
@@ -2210,7 +5697,7 @@ static size_t dump_patch(uint8_t *p, size_t c, size_t n, uint8_t i)
 
     /* Dump the patch name. */
 
-    c = dump_str(p, c, n, 0x30, patch[i].name, DEF_PATCH_NAME);
+    c = dump_str(p, c, n, 0x30, edit[i].name, DEF_PATCH_NAME);
 
     /* Dump all patch parameters. */
 
@@ -2225,6 +5712,51 @@ static size_t dump_patch(uint8_t *p, size_t c, size_t n, uint8_t i)
     return c;
 }
 
+static size_t dump_effects(uint8_t *p, size_t c, size_t n)
+{
+    /* Dump effect parameters. */
+
+    c = dump_val(p, c, n, 0x20, reverb.level, DEF_REVERB_LEVEL);
+    c = dump_val(p, c, n, 0x21, reverb.time,  DEF_REVERB_TIME);
+    c = dump_val(p, c, n, 0x22, reverb.damp,  DEF_REVERB_DAMP);
+    c = dump_val(p, c, n, 0x23, reverb.size,  DEF_REVERB_SIZE);
+
+    c = dump_val(p, c, n, 0x24, chorus.level, DEF_CHORUS_LEVEL);
+    c = dump_val(p, c, n, 0x25, chorus.rate,  DEF_CHORUS_RATE);
+    c = dump_val(p, c, n, 0x26, chorus.depth, DEF_CHORUS_DEPTH);
+    c = dump_val(p, c, n, 0x27, chorus.delay, DEF_CHORUS_DELAY);
+
+    c = dump_val(p, c, n, 0x28, limiter.level,   DEF_LIMITER_LEVEL);
+    c = dump_val(p, c, n, 0x29, limiter.release, DEF_LIMITER_RELEASE);
+
+    c = dump_val(p, c, n, 0x2A, smooth_time, DEF_SMOOTH_TIME);
+
+    return c;
+}
+
+static size_t dump_channel(uint8_t *p, size_t c, size_t n, uint8_t i)
+{
+    struct snth_channel *h = channel + i;
+
+    /* Dump channel mixer parameters. */
+
+    c = dump_val(p, c, n, 0x10, h->level,  DEF_CHANNEL_LEVEL);
+    c = dump_val(p, c, n, 0x11, h->pan,    DEF_CHANNEL_PAN);
+    c = dump_val(p, c, n, 0x12, h->reverb, DEF_CHANNEL_REVERB);
+    c = dump_val(p, c, n, 0x13, h->chorus, DEF_CHANNEL_CHORUS);
+
+    c = dump_val(p, c, n, 0x14, h->eq_low,  DEF_CHANNEL_EQ_LOW);
+    c = dump_val(p, c, n, 0x15, h->eq_mid,  DEF_CHANNEL_EQ_MID);
+    c = dump_val(p, c, n, 0x16, h->eq_freq, DEF_CHANNEL_EQ_FREQ);
+    c = dump_val(p, c, n, 0x17, h->eq_high, DEF_CHANNEL_EQ_HIGH);
+    c = dump_val(p, c, n, 0x18, h->drive,   DEF_CHANNEL_DRIVE);
+
+    c = dump_val(p, c, n, 0x19, h->azimuth,   DEF_CHANNEL_AZIMUTH);
+    c = dump_val(p, c, n, 0x1A, h->elevation, DEF_CHANNEL_ELEVATION);
+
+    return c;
+}
+
 /*---------------------------------------------------------------------------*/
 
 size_t snth_dump_patch(void *d, size_t n)
@@ -2239,9 +5771,13 @@ size_t snth_dump_patch(void *d, size_t n)
     if (c < n) p[c++] = 0xF0;
     if (c < n) p[c++] = SNTH_SYSEX;
 
-    /* Dump the patch. */
+    /* Dump the patch, waiting out any edit of it. */
 
-    c = dump_patch(p, c, n, channel[curr_chan].patch);
+    if (snth_take_edit())
+    {
+        c = dump_patch(p, c, n, channel[curr_chan].patch);
+        snth_give_edit();
+    }
 
     /* Dump the SysEx footer. */
 
@@ -2262,15 +5798,29 @@ size_t snth_dump_state(void *d, size_t n)
     if (c < n) p[c++] = 0xF0;
     if (c < n) p[c++] = SNTH_SYSEX;
 
-    /* Dump the complete system state. */
+    /* Dump the complete system state, waiting out any patch edit. */
     
-    for (i = 0; i < MAXPATCH; ++i)
-        if (snth_stat_patch(i))
+    if (snth_take_edit())
+    {
+        for (i = 0; i < MAXPATCH; ++i)
+            if (snth_stat_patch(i))
+            {
+                c = dump_val(p, c, n, 0x02, i, 0xFF);
+                c = dump_patch(p, c, n, i);
+            }
+        snth_give_edit();
+    }
+
+    for (i = 0; i < MAXCHANNEL; ++i)
+        if (snth_stat_channel(i))
         {
-            c = dump_val(p, c, n, 0x02, i, 0xFF);
-            c = dump_patch(p, c, n, i);
+            c = dump_val(p, c, n, 0x00, i, 0xFF);
+            c = dump_channel(p, c, n, i);
         }
 
+    if (snth_stat_effects())
+        c = dump_effects(p, c, n);
+
     /* Dump the SysEx footer. */
 
     if (c < n) p[c++] = 0xF7;
@@ -2288,17 +5838,51 @@ static size_t snth_midi_sysex_global(const uint8_t *p, size_t i)
     case 0x00: snth_set_channel(p[i + 1]); break;
     case 0x01: snth_set_bank   (p[i + 1]); break;
     case 0x02: snth_set_patch  (p[i + 1]); break;
+    case 0x03: edit_patch = p[i + 1] & 0x7F; break;
     }
     return i + 2;
 }
 
 static size_t snth_midi_sysex_channel(const uint8_t *p, size_t i)
 {
+    switch (p[i] & 0x0F)
+    {
+    case 0x00: snth_set_channel_level (p[i + 1]); break;
+    case 0x01: snth_set_channel_pan   (p[i + 1]); break;
+    case 0x02: snth_set_channel_reverb(p[i + 1]); break;
+    case 0x03: snth_set_channel_chorus(p[i + 1]); break;
+
+    case 0x04: snth_set_channel_eq_low (p[i + 1]); break;
+    case 0x05: snth_set_channel_eq_mid (p[i + 1]); break;
+    case 0x06: snth_set_channel_eq_freq(p[i + 1]); break;
+    case 0x07: snth_set_channel_eq_high(p[i + 1]); break;
+    case 0x08: snth_set_channel_drive  (p[i + 1]); break;
+
+    case 0x09: snth_set_channel_azimuth  (p[i + 1]); break;
+    case 0x0A: snth_set_channel_elevation(p[i + 1]); break;
+    }
     return i + 2;
 }
 
 static size_t snth_midi_sysex_effects(const uint8_t *p, size_t i)
 {
+    switch (p[i] & 0x0F)
+    {
+    case 0x00: snth_set_reverb_level(p[i + 1]); break;
+    case 0x01: snth_set_reverb_time (p[i + 1]); break;
+    case 0x02: snth_set_reverb_damp (p[i + 1]); break;
+    case 0x03: snth_set_reverb_size (p[i + 1]); break;
+
+    case 0x04: snth_set_chorus_level(p[i + 1]); break;
+    case 0x05: snth_set_chorus_rate (p[i + 1]); break;
+    case 0x06: snth_set_chorus_depth(p[i + 1]); break;
+    case 0x07: snth_set_chorus_delay(p[i + 1]); break;
+
+    case 0x08: snth_set_limiter_level  (p[i + 1]); break;
+    case 0x09: snth_set_limiter_release(p[i + 1]); break;
+
+    case 0x0A: snth_set_smooth_time(p[i + 1]); break;
+    }
     return i + 2;
 }
 
@@ -2388,69 +5972,389 @@ static size_t snth_midi_sysex_lfo(const uint8_t *p, size_t i)
     return i + 2;
 }
 
-static size_t snth_midi_sysex(const uint8_t *p, size_t i)
+/* SysEx commands are dispatched by the high nibble of their code byte.     */
+
+typedef size_t (*snth_sysex_fn)(const uint8_t *, size_t);
+
+static const snth_sysex_fn sysex_fn[16] = {
+    snth_midi_sysex_global,
+    snth_midi_sysex_channel,
+    snth_midi_sysex_effects,
+    snth_midi_sysex_patch,
+    snth_midi_sysex_env,
+    snth_midi_sysex_env,
+    snth_midi_sysex_env,
+    snth_midi_sysex_env,
+    snth_midi_sysex_lfo,
+    snth_midi_sysex_lfo,
+    snth_midi_sysex_lfo,
+    snth_midi_sysex_lfo,
+    snth_midi_sysex_tone,
+    snth_midi_sysex_tone,
+    snth_midi_sysex_tone,
+    snth_midi_sysex_tone,
+};
+
+void snth_set_param(uint8_t i, uint8_t tone, uint8_t param, uint8_t value)
+{
+    const uint8_t c[2] = { (uint8_t) (param | (tone << 4)), value };
+
+    assert(i     < MAXPATCH);
+    assert(tone  < MAXTONE);
+    assert(param & 0xC0);
+
+    /* Apply a tone, envelope, or LFO SysEx to the named patch. */
+
+    if (snth_take_edit())
+    {
+        edit_patch = i;
+        sysex_fn[c[0] >> 4](c, 0);
+        edit_patch = -1;
+
+        snth_give_edit();
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+/* Shared parameter table                                                    */
+
+/* The renderer remembers the sequence number of each value it has applied, */
+/* so that a dirty bit left by a stale write applies nothing.               */
+
+static struct snth_shared *volatile shared = NULL;
+static uint32_t                     shared_seq[SNTH_SHARED_SIZE];
+
+void snth_init_shared(struct snth_shared *S)
+{
+    memset(S, 0, sizeof (struct snth_shared));
+    S->magic = SNTH_SHARED_MAGIC;
+}
+
+void snth_set_shared(struct snth_shared *S)
+{
+    unsigned epoch;
+
+    assert(S == NULL || S->magic == SNTH_SHARED_MAGIC);
+
+    /* Detach any current table and wait for the renderer to let it go. */
+
+    shared = NULL;
+    __sync_synchronize();
+    epoch = render_epoch;
+
+    while (!snth_quiet(epoch))
+        sched_yield();
+
+    /* Attach the new table with nothing yet applied. */
+
+    memset(shared_seq, 0, sizeof (shared_seq));
+    __sync_synchronize();
+    shared = S;
+}
+
+void snth_put_shared(struct snth_shared *S, int row, uint8_t code,
+                                                     uint8_t value)
+{
+    const int i = row * 256 + code;
+
+    assert(0 <= row && row < SNTH_SHARED_ROWS);
+
+    S->value[i] = value;
+    S->seq  [i] = S->seq[i] + 1;
+
+    __sync_synchronize();
+    __sync_fetch_and_or(S->dirty + (i   >> 5), 1U << (i   & 31));
+    __sync_fetch_and_or(S->rows  + (row >> 5), 1U << (row & 31));
+}
+
+static void snth_put_shared_value(int row, uint8_t code, uint8_t value)
+{
+    const uint8_t c[2] = { code, value };
+
+    /* Apply a patch or effects code, ignoring any other. */
+
+    if (row < SNTH_SHARED_EFFECTS)
+    {
+        if ((code & 0xC0) && code != 0xF7 && row < MAXPATCH)
+            snth_set_param((uint8_t) row, (code & 0x30) >> 4,
+                                           code & 0xCF, value);
+    }
+    else if ((code >> 4) == 2)
+        sysex_fn[2](c, 0);
+}
+
+static void snth_get_shared(void)
 {
-    i++;
+    struct snth_shared *S = shared;
 
-    /* Process SysEx messages carrying the recognized ID.  Skip others. */
+    int n = 0;
+    int w;
+    int k;
 
-    if (p[i] == SNTH_SYSEX)
+    /* Leave every dirty bit for the next block while another thread is */
+    /* editing patches.                                                  */
+
+    if (S == NULL || !snth_try_edit())
+        return;
+
+    /* Claim each dirty row, then each dirty word of that row. */
+
+    for (w = 0; w < (SNTH_SHARED_ROWS + 31) / 32; ++w)
     {
-        i++;
+        uint32_t r = S->rows[w] ? __sync_fetch_and_and(S->rows + w, 0) : 0;
 
-        while (p[i] != 0xF7)
+        while (r)
         {
-            if      ((p[i] & 0xF0) == 0x00) i = snth_midi_sysex_global (p, i);
-            else if ((p[i] & 0xF0) == 0x10) i = snth_midi_sysex_channel(p, i);
-            else if ((p[i] & 0xF0) == 0x20) i = snth_midi_sysex_effects(p, i);
-            else if ((p[i] & 0xF0) == 0x30) i = snth_midi_sysex_patch  (p, i);
-            else if ((p[i] & 0xC0) == 0x40) i = snth_midi_sysex_env    (p, i);
-            else if ((p[i] & 0xC0) == 0x80) i = snth_midi_sysex_lfo    (p, i);
-            else if ((p[i] & 0xC0) == 0xC0) i = snth_midi_sysex_tone   (p, i);
+            const int row = w * 32 + __builtin_ctz(r);
+
+            r &= r - 1;
+
+            for (k = row * 8; k < row * 8 + 8; ++k)
+            {
+                uint32_t d = S->dirty[k] ? __sync_fetch_and_and(S->dirty + k,
+                                                                0) : 0;
+                while (d)
+                {
+                    const int i = k * 32 + __builtin_ctz(d);
+                    uint32_t  s = S->seq[i];
+
+                    d &= d - 1;
+
+                    /* Apply each value written since it was last applied. */
+
+                    if (s != shared_seq[i])
+                    {
+                        __sync_synchronize();
+
+                        if (n++ == 0)
+                            snth_begin();
+
+                        shared_seq[i] = s;
+                        snth_put_shared_value(row, (uint8_t) (i & 0xFF),
+                                                   S->value[i]);
+                    }
+                }
+            }
         }
     }
-    else
-        while (p[i] != 0xF7)
-            i++;
 
-    return i + 1;
+    if (n)
+        snth_commit();
+
+    snth_give_edit();
+}
+
+enum {
+    SYSEX_NONE,         /* Outside of any SysEx                          */
+    SYSEX_ID,           /* Awaiting the manufacturer ID                  */
+    SYSEX_CODE,         /* Decoding SNTH commands                        */
+    SYSEX_SKIP          /* Skipping a foreign SysEx                      */
+};
+
+static void snth_midi_sysex(struct snth_parser *P, uint8_t b)
+{
+    switch (P->sysex)
+    {
+    case SYSEX_ID:
+        P->sysex = (b == SNTH_SYSEX) ? SYSEX_CODE : SYSEX_SKIP;
+        P->size  = 0;
+
+        /* Apply each SNTH SysEx as a single bulk edit. */
+
+        if (P->sysex == SYSEX_CODE)
+            snth_begin();
+        break;
+
+    case SYSEX_CODE:
+
+        /* Gather a command and apply it once complete.  Patch names run */
+        /* to a NUL, truncated if too long.  All others carry one value. */
+
+        P->code[P->size++] = b;
+
+        if (P->code[0] == 0x30)
+        {
+            if (b)
+            {
+                if (P->size == SNTH_MAXCODE)
+                    P->size--;
+                break;
+            }
+            snth_midi_sysex_patch(P->code, 0);
+            P->size = 0;
+        }
+        else if (P->size == 2)
+        {
+            sysex_fn[P->code[0] >> 4](P->code, 0);
+            P->size = 0;
+        }
+        break;
+    }
 }
 
 /*---------------------------------------------------------------------------*/
 /* MIDI input                                                                */
 
-static size_t snth_midi_note_off(const uint8_t *p, size_t i)
+static void snth_midi_note_off(uint8_t s, uint8_t a, uint8_t b)
 {
-    uint8_t c = p[i + 0] & 0x0F;
-    uint8_t n = p[i + 1];
-    uint8_t v = p[i + 2];
+    snth_note_off(s & 0x0F, a, b);
+}
+
+static void snth_midi_note_on(uint8_t s, uint8_t a, uint8_t b)
+{
+    /* A note-on with zero velocity is a note-off. */
 
-    snth_note_off(c, n, v);
+    if (b)
+        snth_note_on (s & 0x0F, a, b);
+    else
+        snth_note_off(s & 0x0F, a, b);
+}
 
-    return i + 3;
+static void snth_midi_touch(uint8_t s, uint8_t a, uint8_t b)
+{
+    snth_touch(s & 0x0F, a, b);
 }
 
-static size_t snth_midi_note_on(const uint8_t *p, size_t i)
+static void snth_midi_control(uint8_t s, uint8_t a, uint8_t b)
 {
-    uint8_t c = p[i + 0] & 0x0F;
-    uint8_t n = p[i + 1];
-    uint8_t v = p[i + 2];
+    snth_control(s & 0x0F, a, b);
+}
 
-    snth_note_on(c, n, v);
+static void snth_midi_program(uint8_t s, uint8_t a, uint8_t b)
+{
+    snth_program(s & 0x0F, a);
+}
 
-    return i + 3;
+static void snth_midi_pressure(uint8_t s, uint8_t a, uint8_t b)
+{
+    snth_pressure(s & 0x0F, a);
 }
 
-void snth_midi(const void *d, size_t n)
+static void snth_midi_bend(uint8_t s, uint8_t a, uint8_t b)
+{
+    snth_bend(s & 0x0F, (uint16_t) (a | (b << 7)));
+}
+
+/* Channel messages are dispatched by the high nibble of their status.      */
+
+typedef void (*snth_midi_fn)(uint8_t, uint8_t, uint8_t);
+
+static const uint8_t midi_len[8] = { 2, 2, 2, 2, 1, 1, 2, 0 };
+
+static const snth_midi_fn midi_fn[8] = {
+    snth_midi_note_off,
+    snth_midi_note_on,
+    snth_midi_touch,
+    snth_midi_control,
+    snth_midi_program,
+    snth_midi_pressure,
+    snth_midi_bend,
+    NULL,
+};
+
+/* System common messages cancel running status.  Their data is skipped.   */
+
+static const uint8_t common_len[8] = { 0, 1, 2, 1, 0, 0, 0, 0 };
+
+void snth_init_parser(struct snth_parser *P)
+{
+    memset(P, 0, sizeof (struct snth_parser));
+}
+
+void snth_parse(struct snth_parser *P, const void *d, size_t n)
 {
     const uint8_t *p = (const uint8_t *) d;
 
-    size_t i = 0;
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+    {
+        const uint8_t b = p[i];
+
+        /* SNTH command codes use the high bit, so within an SNTH SysEx  */
+        /* only an 0xF7 in place of a code ends it.                      */
 
-    while (i < n)
-        if      ((p[i])        == 0xF0) i = snth_midi_sysex   (p, i);
-        else if ((p[i] & 0xF0) == 0x80) i = snth_midi_note_off(p, i);
-        else if ((p[i] & 0xF0) == 0x90) i = snth_midi_note_on (p, i);
+        if (P->sysex == SYSEX_CODE)
+        {
+            if (P->size == 0 && b == 0xF7)
+            {
+                P->sysex   = SYSEX_NONE;
+                edit_patch = -1;
+                snth_commit();
+            }
+            else
+                snth_midi_sysex(P, b);
+            continue;
+        }
+
+        /* Real-time bytes may fall anywhere and are ignored. */
+
+        if (b >= 0xF8)
+            continue;
+
+        if (b & 0x80)
+        {
+            /* A status byte ends any other SysEx and begins a new message. */
+
+            P->sysex = SYSEX_NONE;
+
+            if (b == 0xF0)
+            {
+                P->sysex  = SYSEX_ID;
+                P->status = 0;
+            }
+            else if (b >= 0xF0)
+            {
+                P->status = 0;
+                P->need   = common_len[b & 0x07];
+            }
+            else
+            {
+                P->status = b;
+                P->need   = midi_len[(b >> 4) & 0x07];
+            }
+            P->have = 0;
+        }
+        else if (P->sysex)
+            snth_midi_sysex(P, b);
+
+        else if (P->have < P->need)
+        {
+            /* Gather data bytes, applying the message once complete. */
+
+            P->data[P->have++] = b;
+
+            if (P->have == P->need)
+            {
+                if (P->status)
+                {
+                    const snth_midi_fn f = midi_fn[(P->status >> 4) & 0x07];
+
+                    if (f) f(P->status, P->data[0], P->data[1]);
+
+                    P->have = 0;
+                }
+                else
+                    P->need = 0;
+            }
+        }
+    }
+}
+
+void snth_midi(const void *d, size_t n)
+{
+    struct snth_parser P;
+
+    snth_init_parser(&P);
+    snth_parse(&P, d, n);
+
+    /* Commit any SysEx left open at the end of the buffer. */
+
+    if (P.sysex == SYSEX_CODE)
+    {
+        edit_patch = -1;
+        snth_commit();
+    }
 }
 
 /*===========================================================================*/
@@ -2464,11 +6368,67 @@ static void snth_init_channel(uint8_t i)
     channel[i].pan    = DEF_CHANNEL_PAN;
     channel[i].reverb = DEF_CHANNEL_REVERB;
     channel[i].chorus = DEF_CHANNEL_CHORUS;
+
+    channel[i].eq_low  = DEF_CHANNEL_EQ_LOW;
+    channel[i].eq_mid  = DEF_CHANNEL_EQ_MID;
+    channel[i].eq_freq = DEF_CHANNEL_EQ_FREQ;
+    channel[i].eq_high = DEF_CHANNEL_EQ_HIGH;
+    channel[i].drive   = DEF_CHANNEL_DRIVE;
+
+    channel[i].azimuth   = DEF_CHANNEL_AZIMUTH;
+    channel[i].elevation = DEF_CHANNEL_ELEVATION;
+
+    snth_set_insert_cache(i);
+
+    /* Set controller defaults.  Full volume leaves the level unscaled. */
+
+    channel[i].bank        = 0;
+    channel[i].mod_range   = 2;
+    channel[i].mod_volume  = 127;
+    channel[i].mod_pan     = 64;
+    channel[i].mod_sustain = 0;
+
+    snth_init_mod(i);
+
+    memset(channel[i].note, 0xFF, sizeof (channel[i].note));
+}
+
+static void snth_init_effects(void)
+{
+    /* Set effect defaults and clear all effect state. */
+
+    memset(&reverb, 0, sizeof (struct snth_reverb));
+
+    reverb.level = DEF_REVERB_LEVEL;
+    reverb.time  = DEF_REVERB_TIME;
+    reverb.damp  = DEF_REVERB_DAMP;
+    reverb.size  = DEF_REVERB_SIZE;
+
+    snth_set_reverb_cache();
+
+    memset(&chorus, 0, sizeof (struct snth_chorus));
+
+    chorus.level = DEF_CHORUS_LEVEL;
+    chorus.rate  = DEF_CHORUS_RATE;
+    chorus.depth = DEF_CHORUS_DEPTH;
+    chorus.delay = DEF_CHORUS_DELAY;
+
+    snth_set_chorus_cache();
+
+    memset(&limiter, 0, sizeof (struct snth_limiter));
+
+    limiter.level   = DEF_LIMITER_LEVEL;
+    limiter.release = DEF_LIMITER_RELEASE;
+
+    snth_reset_limiter();
+    snth_set_limiter_cache();
+
+    snth_set_smooth_time(DEF_SMOOTH_TIME);
 }
 
 static void snth_init_env(uint8_t i, uint8_t j, uint8_t k)
 {
-    struct snth_env *e = patch[i].tone[j].env + k;
+    struct snth_env *e = edit[i].tone[j].env + k;
 
     /* Set envelope defaults. */
 
@@ -2482,7 +6442,7 @@ static void snth_init_env(uint8_t i, uint8_t j, uint8_t k)
 
 static void snth_init_lfo(uint8_t i, uint8_t j, uint8_t k)
 {
-    struct snth_lfo *l = patch[i].tone[j].lfo + k;
+    struct snth_lfo *l = edit[i].tone[j].lfo + k;
 
     /* Set LFO defaults. */
 
@@ -2501,7 +6461,7 @@ static void snth_init_lfo(uint8_t i, uint8_t j, uint8_t k)
 
 static void snth_init_tone(uint8_t i, uint8_t j)
 {
-    struct snth_tone *t = patch[i].tone + j;
+    struct snth_tone *t = edit[i].tone + j;
 
     int def_tone_mode = j ? DEF_TONE_MODE : SNTH_MODE_MIX;
 
@@ -2532,7 +6492,7 @@ static void snth_init_patch(uint8_t i)
 
     /* Set patch defaults. */
 
-    strncpy(patch[i].name, DEF_PATCH_NAME, MAXSTR);
+    strncpy(edit[i].name, DEF_PATCH_NAME, MAXSTR);
 
     for (j = 0; j < MAXTONE; ++j)
     {
@@ -2571,18 +6531,41 @@ void snth_init(int r)
         freq_tab_d[i] = k1 - k0;
     }
 
-    /* Initialize all channels and patches. */
+    /* Initialize all channels and patches, publishing the patches once. */
+
+    edit_lock  = 0;
+    edit_held  = 0;
+    edit_depth = 0;
+    edit_patch = -1;
+
+    memset(edit_dirty, 0, sizeof (edit_dirty));
+
+    snth_init_versions();
 
     for (i = 0; i < MAXCHANNEL; ++i)
         snth_init_channel(i);
+
+    snth_begin();
     for (i = 0; i < MAXPATCH; ++i)
         snth_init_patch(i);
+    snth_commit();
+
+    snth_init_effects();
 
     /* Initialize all notes. */
 
     memset(note, 0, MAXNOTE * sizeof (struct snth_note));
 
-    curr_chan = 0;
+    for (i = 0; i < MAXNOTE; ++i)
+        note[i].version = NO_VERSION;
+
+    curr_chan  = 0;
+    hold_n     = 0;
+    event_head = 0;
+    event_tail = 0;
+    event_used = 0;
+    ring_head  = 0;
+    ring_tail  = 0;
 }
 
 /*===========================================================================*/
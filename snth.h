@@ -19,6 +19,163 @@
 
 #define SNTH_SYSEX 0x7D    /* Educational-use SysEx manufacturer ID */
 
+#define SNTH_STEMS    17    /* One stem per MIDI channel plus the mix */
+#define SNTH_STEM_MIX 16
+
+enum {
+    SNTH_FORMAT_S16,    /* Signed 16-bit                                 */
+    SNTH_FORMAT_S24,    /* Signed 24-bit in the low bits of 32           */
+    SNTH_FORMAT_S32,    /* Signed 32-bit                                 */
+    SNTH_FORMAT_F32     /* Float in [-1, 1]                              */
+};
+
+enum {
+    SNTH_LAYOUT_STEREO, /* L R                                           */
+    SNTH_LAYOUT_5_1,    /* L R C LFE Ls Rs                               */
+    SNTH_LAYOUT_7_1,    /* L R C LFE Lb Rb Ls Rs                         */
+    SNTH_LAYOUT_FOA     /* First-order ambisonics W Y Z X, ACN/SN3D      */
+};
+
+#define SNTH_MAXSPEAKER 8
+
+/* Meters 0 through 7 follow the output channels.  Meters from             */
+/* SNTH_METER_STEM follow stems in left-right pairs.                       */
+
+#define SNTH_METER_STEM SNTH_MAXSPEAKER
+#define SNTH_METERS    (SNTH_MAXSPEAKER + 2 * SNTH_STEMS)
+
+struct snth_format
+{
+    int type;           /* One of SNTH_FORMAT_*                          */
+    int planar;         /* Nonzero for separate left and right buffers   */
+    int dither;         /* Nonzero for TPDF dither on 16 and 24-bit      */
+};
+
+/* A MIDI parser takes a byte stream in chunks of any size.  The longest    */
+/* SysEx command is a patch name: a code, up to 255 characters, and a NUL.  */
+
+#define SNTH_MAXCODE 257
+
+struct snth_parser
+{
+    uint8_t  status;    /* Running status, or zero if none               */
+    uint8_t  need;      /* Data bytes the current message takes          */
+    uint8_t  have;      /* Data bytes received so far                    */
+    uint8_t  sysex;     /* SysEx state, or zero if outside a SysEx       */
+    uint8_t  data[2];
+    uint16_t size;      /* Bytes of the current SysEx command so far     */
+    uint8_t  code[SNTH_MAXCODE];
+};
+
+/* A state snapshot copies the current channel, the shared effects, and the  */
+/* last published version of the channel's patch.  Its version counts every  */
+/* change made to that state.  These sizes are those of the synthesizer.     */
+
+#define SNTH_MAXSTR  256
+#define SNTH_MAXTONE 4
+#define SNTH_MAXENV  3
+#define SNTH_MAXLFO  2
+
+struct snth_state_env
+{
+    uint8_t a;
+    uint8_t d;
+    uint8_t s;
+    uint8_t r;
+};
+
+struct snth_state_lfo
+{
+    uint8_t wave;
+    uint8_t sync;
+    uint8_t rate;
+    uint8_t delay;
+    uint8_t level;
+    uint8_t pan;
+    uint8_t pitch;
+    uint8_t phase;
+    uint8_t filter;
+};
+
+struct snth_state_tone
+{
+    uint8_t wave;
+    uint8_t mode;
+    uint8_t level;
+    uint8_t pan;
+    uint8_t delay;
+    uint8_t pitch_coarse;
+    uint8_t pitch_fine;
+    uint8_t pitch_env;
+    uint8_t filter_mode;
+    uint8_t filter_cut;
+    uint8_t filter_res;
+    uint8_t filter_env;
+    uint8_t filter_key;
+
+    struct snth_state_env env[SNTH_MAXENV];
+    struct snth_state_lfo lfo[SNTH_MAXLFO];
+};
+
+struct snth_state
+{
+    unsigned version;   /* Count of changes published so far             */
+
+    uint8_t channel;
+    uint8_t patch;
+    uint8_t bank;
+
+    uint8_t channel_level;
+    uint8_t channel_pan;
+    uint8_t channel_reverb;
+    uint8_t channel_chorus;
+    uint8_t channel_eq_low;
+    uint8_t channel_eq_mid;
+    uint8_t channel_eq_freq;
+    uint8_t channel_eq_high;
+    uint8_t channel_drive;
+    uint8_t channel_azimuth;
+    uint8_t channel_elevation;
+
+    uint8_t reverb_level;
+    uint8_t reverb_time;
+    uint8_t reverb_damp;
+    uint8_t reverb_size;
+    uint8_t chorus_level;
+    uint8_t chorus_rate;
+    uint8_t chorus_depth;
+    uint8_t chorus_delay;
+    uint8_t limiter_level;
+    uint8_t limiter_release;
+    uint8_t smooth_time;
+
+    char patch_name[SNTH_MAXSTR];
+
+    struct snth_state_tone tone[SNTH_MAXTONE];
+};
+
+/* A shared parameter table lets another process automate parameters by      */
+/* plain stores into memory it maps with the engine.  Each row holds one     */
+/* value per SysEx code byte: rows below SNTH_SHARED_EFFECTS address the     */
+/* tone, envelope, and LFO codes of that patch, and the last row addresses   */
+/* the effects codes.  A writer stores the value, increments its sequence    */
+/* number, and then sets its dirty bit and its row bit, as snth_put_shared   */
+/* does.  The renderer applies changed values once per block.                */
+
+#define SNTH_SHARED_MAGIC   0x534E5448
+#define SNTH_SHARED_EFFECTS 128
+#define SNTH_SHARED_ROWS    (SNTH_SHARED_EFFECTS + 1)
+#define SNTH_SHARED_SIZE    (SNTH_SHARED_ROWS * 256)
+
+struct snth_shared
+{
+    uint32_t          magic;
+    volatile uint32_t rows [(SNTH_SHARED_ROWS + 31) / 32];
+    volatile uint32_t dirty[SNTH_SHARED_SIZE / 32];
+    volatile uint32_t seq  [SNTH_SHARED_SIZE];
+    volatile uint8_t  value[SNTH_SHARED_SIZE];
+};
+
 enum {
     SNTH_WAVE_SIN,
     SNTH_WAVE_SQR,
@@ -87,13 +244,38 @@ enum {
 
 #define DEF_CHANNEL_PATCH     0
 #define DEF_CHANNEL_LEVEL     100
-#define DEF_CHANNEL_PAN       0
+#define DEF_CHANNEL_PAN       64
 #define DEF_CHANNEL_REVERB    0
 #define DEF_CHANNEL_CHORUS    0
+#define DEF_CHANNEL_EQ_LOW    64
+#define DEF_CHANNEL_EQ_MID    64
+#define DEF_CHANNEL_EQ_FREQ   64
+#define DEF_CHANNEL_EQ_HIGH   64
+#define DEF_CHANNEL_DRIVE     0
+#define DEF_CHANNEL_AZIMUTH   64
+#define DEF_CHANNEL_ELEVATION 64
+
+#define DEF_REVERB_LEVEL      64
+#define DEF_REVERB_TIME       64
+#define DEF_REVERB_DAMP       64
+#define DEF_REVERB_SIZE       64
+
+#define DEF_CHORUS_LEVEL      64
+#define DEF_CHORUS_RATE       40
+#define DEF_CHORUS_DEPTH      64
+#define DEF_CHORUS_DELAY      64
+
+#define DEF_LIMITER_LEVEL     0
+#define DEF_LIMITER_RELEASE   64
+
+#define DEF_SMOOTH_TIME       8
 
 /*===========================================================================*/
 /* Modifier functions                                                        */
 
+/* There is one bank of 128 patches.  A channel's bank, as set here or by   */
+/* bank select, is stored and reported, but is ignored by program change.    */
+
 void  snth_set_channel(uint8_t);
 void  snth_set_patch  (uint8_t);
 void  snth_set_bank   (uint8_t);
@@ -105,6 +287,36 @@ void  snth_set_channel_pan   (uint8_t);
 void  snth_set_channel_reverb(uint8_t);
 void  snth_set_channel_chorus(uint8_t);
 
+void  snth_set_channel_eq_low (uint8_t);
+void  snth_set_channel_eq_mid (uint8_t);
+void  snth_set_channel_eq_freq(uint8_t);
+void  snth_set_channel_eq_high(uint8_t);
+void  snth_set_channel_drive  (uint8_t);
+
+void  snth_set_channel_azimuth  (uint8_t);
+void  snth_set_channel_elevation(uint8_t);
+
+/*---------------------------------------------------------------------------*/
+
+void  snth_set_layout(int);
+
+/*---------------------------------------------------------------------------*/
+
+void  snth_set_reverb_level(uint8_t);
+void  snth_set_reverb_time (uint8_t);
+void  snth_set_reverb_damp (uint8_t);
+void  snth_set_reverb_size (uint8_t);
+
+void  snth_set_chorus_level(uint8_t);
+void  snth_set_chorus_rate (uint8_t);
+void  snth_set_chorus_depth(uint8_t);
+void  snth_set_chorus_delay(uint8_t);
+
+void  snth_set_limiter_level  (uint8_t);
+void  snth_set_limiter_release(uint8_t);
+
+void  snth_set_smooth_time(uint8_t);
+
 /*---------------------------------------------------------------------------*/
 
 void  snth_set_patch_name(const char *);
@@ -156,6 +368,37 @@ uint8_t snth_get_channel_pan   (void);
 uint8_t snth_get_channel_reverb(void);
 uint8_t snth_get_channel_chorus(void);
 
+uint8_t snth_get_channel_eq_low (void);
+uint8_t snth_get_channel_eq_mid (void);
+uint8_t snth_get_channel_eq_freq(void);
+uint8_t snth_get_channel_eq_high(void);
+uint8_t snth_get_channel_drive  (void);
+
+uint8_t snth_get_channel_azimuth  (void);
+uint8_t snth_get_channel_elevation(void);
+
+/*---------------------------------------------------------------------------*/
+
+int     snth_get_layout  (void);
+int     snth_get_speakers(void);
+
+/*---------------------------------------------------------------------------*/
+
+uint8_t snth_get_reverb_level(void);
+uint8_t snth_get_reverb_time (void);
+uint8_t snth_get_reverb_damp (void);
+uint8_t snth_get_reverb_size (void);
+
+uint8_t snth_get_chorus_level(void);
+uint8_t snth_get_chorus_rate (void);
+uint8_t snth_get_chorus_depth(void);
+uint8_t snth_get_chorus_delay(void);
+
+uint8_t snth_get_limiter_level  (void);
+uint8_t snth_get_limiter_release(void);
+
+uint8_t snth_get_smooth_time(void);
+
 /*---------------------------------------------------------------------------*/
 
 const char *snth_get_patch_name(void);
@@ -193,20 +436,96 @@ uint8_t snth_get_tone_lfo_pitch (uint8_t, uint8_t);
 uint8_t snth_get_tone_lfo_phase (uint8_t, uint8_t);
 uint8_t snth_get_tone_lfo_filter(uint8_t, uint8_t);
 
+/*---------------------------------------------------------------------------*/
+
+/* Copy a consistent snapshot without blocking the renderer.  Return its     */
+/* version.                                                                  */
+
+unsigned snth_get_state(struct snth_state *);
+
 /*===========================================================================*/
 /* Control functions                                                         */
 
+/* Bulk edits defer cache updates and publish all changes at the commit.     */
+/* Patch edits from other threads wait for the commit.  SysEx sent to the    */
+/* audio thread and shared table changes wait for a later chunk or block,    */
+/* and none is dropped.  The audio thread must not call patch setters or     */
+/* begin a bulk edit while rendering.  Bulk parameters are SysEx tone,       */
+/* envelope, and LFO codes with the tone bits clear, set on a patch and tone */
+/* given explicitly.                                                         */
+
+void snth_begin    (void);
+void snth_set_param(uint8_t, uint8_t, uint8_t, uint8_t);
+void snth_commit   (void);
+
+/* Sounding notes keep the patch version they began with, unless following.  */
+
+void snth_set_follow(int);
+
+/* Shared tables are mapped by the application.  Attach one, or NULL.  An    */
+/* attached table must remain mapped until it is detached.                   */
+
+void snth_init_shared(struct snth_shared *);
+void snth_set_shared (struct snth_shared *);
+void snth_put_shared (struct snth_shared *, int, uint8_t, uint8_t);
+
+/*---------------------------------------------------------------------------*/
+
 void snth_note_on (uint8_t, uint8_t, uint8_t);
 void snth_note_off(uint8_t, uint8_t, uint8_t);
 
+/* Controllers modulate a channel as it renders, leaving patches unchanged. */
+
+void snth_control (uint8_t, uint8_t, uint8_t);
+void snth_program (uint8_t, uint8_t);
+void snth_bend    (uint8_t, uint16_t);
+void snth_pressure(uint8_t, uint8_t);
+void snth_touch   (uint8_t, uint8_t, uint8_t);
+
+/* Posted events take effect that many frames into the next output. */
+
+void snth_post_note_on (size_t, uint8_t, uint8_t, uint8_t);
+void snth_post_note_off(size_t, uint8_t, uint8_t, uint8_t);
+void snth_post_midi    (size_t, const void *, size_t);
+
+/* Sent events do the same from other threads without blocking the audio    */
+/* thread, and give zero if the ring is full.                                */
+
+int  snth_send_note_on (size_t, uint8_t, uint8_t, uint8_t);
+int  snth_send_note_off(size_t, uint8_t, uint8_t, uint8_t);
+int  snth_send_midi    (size_t, const void *, size_t);
+
+/* Timed events give a time on any clock in seconds.  Before each output,    */
+/* the audio thread gives the time on that clock of its first frame.         */
+
+int  snth_send_midi_at (double, const void *, size_t);
+void snth_set_clock    (double);
+
 /*---------------------------------------------------------------------------*/
 
 size_t snth_dump_patch(void *, size_t);
 size_t snth_dump_state(void *, size_t);
 
 int  snth_get_output(void *, size_t);
+int  snth_render    (void *[], size_t, const struct snth_format *);
+
+void snth_set_meter(int);
+int  snth_get_meter(float *, float *, size_t);
+
+/* Stems render each channel given a buffer apart from the mix.  Give an     */
+/* array of SNTH_STEMS buffers, indexed by channel with SNTH_STEM_MIX last,  */
+/* any of them NULL.  Each receives interleaved stereo float, unclamped.     */
+/* A stemmed channel is left out of the mix stem, which holds all other      */
+/* channels and the effect returns.  Stems are always stereo.  The frame     */
+/* count must be a multiple of four, and stems may not follow an output of   */
+/* snth_render that held frames over, as stems hold nothing over.            */
+
+int  snth_get_stems (float *[], size_t);
 void snth_midi(const void *, size_t);
 
+void snth_init_parser(struct snth_parser *);
+void snth_parse      (struct snth_parser *, const void *, size_t);
+
 void snth_init(int);
 
 /*===========================================================================*/
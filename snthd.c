@@ -0,0 +1,873 @@
+/*    Copyright (C) 2005 Robert Kooima                                       */
+/*                                                                           */
+/*    SNTHD is free software;  you can redistribute it and/or  modify it     */
+/*    under the terms of the  GNU General Public License  as published by    */
+/*    the  Free Software Foundation;  either version 2 of the License, or    */
+/*    (at your option) any later version.                                    */
+/*                                                                           */
+/*    This program is distributed in the hope that it will be useful, but    */
+/*    WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of    */
+/*    MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU    */
+/*    General Public License for more details.                               */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <alsa/asoundlib.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "snth.h"
+#include "osc.h"
+#include "rt.h"
+
+#define SEQ_NAME "LibSNTH Daemon"
+
+/* The daemon runs in a single thread.  One poll loop reads MIDI input and   */
+/* renders audio as the output needs it, so the thread sending events to the */
+/* ring is also the one draining it.  Only OSC input adds a thread.          */
+
+/*---------------------------------------------------------------------------*/
+
+#define PERIOD 512
+#define BUFFER 1024
+#define RATE   44100
+
+#define MAXMIDI 65536
+#define MAXPOLL 16
+
+static snd_pcm_uframes_t period_size = PERIOD;
+static snd_pcm_uframes_t buffer_size = BUFFER;
+
+static volatile sig_atomic_t quit = 0;
+
+/*---------------------------------------------------------------------------*/
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (double) t.tv_sec + (double) t.tv_nsec / 1000000000.0;
+}
+
+/* Events play a fixed latency after they arrive: a full output buffer plus  */
+/* a period, as in SNTHGUI.                                                  */
+
+static double latency(void)
+{
+    return (double) (buffer_size + period_size) / RATE;
+}
+
+static void put_midi(double t, const void *d, size_t n)
+{
+    /* This thread drains the ring, so it cannot wait for room.  Apply a */
+    /* message at once if the ring is full or the message too long.      */
+
+    if (!snth_send_midi_at(t, d, n))
+        snth_midi(d, n);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void do_snd_ck(const char *str, int err)
+{
+    if (err < 0)
+    {
+        fprintf(stderr, "ALSA error: '%s', %s\n", str, snd_strerror(err));
+        exit(1);
+    }
+}
+
+#define snd_ck(F)  do_snd_ck(#F, F);
+
+static void fail(const char *str, const char *arg)
+{
+    fprintf(stderr, "snthd: %s '%s'\n", str, arg);
+    exit(1);
+}
+
+/*===========================================================================*/
+/* MIDI byte streams                                                         */
+
+/* Raw MIDI, FIFOs, and files give bytes in chunks of any size, but each     */
+/* ring record must hold whole messages.  A frame gathers bytes into         */
+/* messages, expanding running status.  SNTH command codes use the high bit, */
+/* so only 0xF7 ends an SNTH SysEx.  Any other SysEx ends at a status byte.  */
+
+struct frame
+{
+    uint8_t status;
+    size_t  n;
+    uint8_t d[MAXMIDI];
+};
+
+static struct frame frame;
+
+static size_t frame_size(uint8_t status)
+{
+    switch (status & 0xF0)
+    {
+    case 0xC0:
+    case 0xD0: return 2;
+    default:   return 3;
+    }
+}
+
+static void frame_byte(struct frame *F, uint8_t b, double t)
+{
+    if (F->status == 0xF0)
+    {
+        if (b == 0xF7)
+        {
+            /* Send a complete SysEx, unless it overflowed the frame. */
+
+            if (F->n < MAXMIDI)
+            {
+                F->d[F->n++] = b;
+                put_midi(t, F->d, F->n);
+            }
+            F->status = 0;
+            return;
+        }
+        if (b < 0x80 || (F->n >= 2 && F->d[1] == SNTH_SYSEX))
+        {
+            if (F->n < MAXMIDI - 1)
+                F->d[F->n++] = b;
+            else
+                F->n = MAXMIDI;
+            return;
+        }
+        if (b < 0xF8)
+            F->status = 0;
+    }
+
+    /* Real-time bytes may fall anywhere and are ignored. */
+
+    if (b >= 0xF8)
+        return;
+
+    /* A status byte begins a message.  System common messages are ignored */
+    /* and cancel running status.                                          */
+
+    if (b & 0x80)
+    {
+        F->status = (b <= 0xF0) ? b : 0;
+        F->d[0]   = b;
+        F->n      = 1;
+        return;
+    }
+
+    /* Data bytes complete a message, leaving its status to run on. */
+
+    if (F->status)
+    {
+        F->d[F->n++] = b;
+
+        if (F->n == frame_size(F->status))
+        {
+            put_midi(t, F->d, F->n);
+            F->n = 1;
+        }
+    }
+}
+
+static void frame_bytes(struct frame *F, const uint8_t *p, size_t n, double t)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        frame_byte(F, p[i], t);
+}
+
+/*===========================================================================*/
+/* MIDI input                                                                */
+
+/* Input comes from one source: the ALSA sequencer, an ALSA raw MIDI device, */
+/* or a byte stream read from a FIFO, a file, or stdin.                      */
+
+static snd_seq_t     *seq    = NULL;
+static snd_rawmidi_t *raw    = NULL;
+static int            in_fd  = -1;
+static int            in_eof =  0;
+
+static int            seq_queue;
+static double         seq_start;
+
+/*---------------------------------------------------------------------------*/
+
+static void seq_init(const char *from)
+{
+    snd_seq_port_info_t *info;
+    snd_seq_addr_t       addr;
+
+    snd_ck(snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX,
+                                         SND_SEQ_NONBLOCK));
+
+    snd_seq_set_client_name(seq, SEQ_NAME);
+
+    /* Create a queue to stamp incoming events with real time. */
+
+    seq_queue = snd_seq_alloc_named_queue(seq, SEQ_NAME);
+
+    /* Create a writable port stamping all subscribers' events. */
+
+    snd_seq_port_info_alloca(&info);
+
+    snd_seq_port_info_set_name           (info, SEQ_NAME);
+    snd_seq_port_info_set_capability     (info, SND_SEQ_PORT_CAP_WRITE |
+                                                SND_SEQ_PORT_CAP_SUBS_WRITE);
+    snd_seq_port_info_set_type           (info, SND_SEQ_PORT_TYPE_APPLICATION);
+    snd_seq_port_info_set_timestamping   (info, 1);
+    snd_seq_port_info_set_timestamp_real (info, 1);
+    snd_seq_port_info_set_timestamp_queue(info, seq_queue);
+
+    snd_ck(snd_seq_create_port(seq, info));
+
+    /* Connect the named sender, if any.  Others may connect with aconnect. */
+
+    if (from)
+    {
+        if (snd_seq_parse_address(seq, &addr, from) < 0)
+            fail("unknown sequencer client", from);
+
+        snd_ck(snd_seq_connect_from(seq, snd_seq_port_info_get_port(info),
+                                         addr.client, addr.port));
+    }
+
+    /* Start the queue, noting its zero on the monotonic clock. */
+
+    snd_seq_start_queue(seq, seq_queue, NULL);
+    snd_seq_drain_output(seq);
+
+    seq_start = now();
+}
+
+static double seq_time(const snd_seq_event_t *e)
+{
+    if (snd_seq_ev_is_real(e))
+        return seq_start + latency()
+                         + (double) e->time.time.tv_sec
+                         + (double) e->time.time.tv_nsec / 1000000000.0;
+    else
+        return now() + latency();
+}
+
+static void seq_send(double t, uint8_t s, int a, int b, size_t n)
+{
+    uint8_t d[3] = { s, (uint8_t) (a & 0x7F), (uint8_t) (b & 0x7F) };
+
+    put_midi(t, d, n);
+}
+
+static void seq_step(void)
+{
+    snd_seq_event_t   *e;
+    snd_seq_ev_ctrl_t *c;
+
+    while (snd_seq_event_input(seq, &e) >= 0 && e)
+    {
+        double t = seq_time(e);
+        int    v;
+
+        c = &e->data.control;
+
+        switch (e->type)
+        {
+        case SND_SEQ_EVENT_NOTEON:
+            seq_send(t, 0x90 | e->data.note.channel, e->data.note.note,
+                                                     e->data.note.velocity, 3);
+            break;
+        case SND_SEQ_EVENT_NOTEOFF:
+            seq_send(t, 0x80 | e->data.note.channel, e->data.note.note,
+                                                     e->data.note.velocity, 3);
+            break;
+        case SND_SEQ_EVENT_KEYPRESS:
+            seq_send(t, 0xA0 | e->data.note.channel, e->data.note.note,
+                                                     e->data.note.velocity, 3);
+            break;
+        case SND_SEQ_EVENT_CONTROLLER:
+            seq_send(t, 0xB0 | c->channel, c->param, c->value, 3);
+            break;
+        case SND_SEQ_EVENT_PGMCHANGE:
+            seq_send(t, 0xC0 | c->channel, c->value, 0, 2);
+            break;
+        case SND_SEQ_EVENT_CHANPRESS:
+            seq_send(t, 0xD0 | c->channel, c->value, 0, 2);
+            break;
+        case SND_SEQ_EVENT_PITCHBEND:
+            v = c->value + 8192;
+            seq_send(t, 0xE0 | c->channel, v, v >> 7, 3);
+            break;
+        case SND_SEQ_EVENT_SYSEX:
+
+            /* Long SysEx may arrive in pieces.  Frame them. */
+
+            frame_bytes(&frame, (const uint8_t *) e->data.ext.ptr,
+                                                  e->data.ext.len, t);
+            break;
+        }
+
+        snd_seq_free_event(e);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void raw_init(const char *name)
+{
+    snd_ck(snd_rawmidi_open(&raw, NULL, name, SND_RAWMIDI_NONBLOCK));
+}
+
+static void raw_step(void)
+{
+    const double t = now() + latency();
+
+    uint8_t d[256];
+    ssize_t n;
+
+    while ((n = snd_rawmidi_read(raw, d, sizeof (d))) > 0)
+        frame_bytes(&frame, d, (size_t) n, t);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void file_init(const char *name)
+{
+    struct stat st;
+
+    /* A FIFO is held open for writing too, so that it never reaches EOF */
+    /* as writers come and go.                                           */
+
+    if (strcmp(name, "-") == 0)
+        in_fd = STDIN_FILENO;
+    else if (stat(name, &st) == 0 && S_ISFIFO(st.st_mode))
+        in_fd = open(name, O_RDWR);
+    else
+        in_fd = open(name, O_RDONLY);
+
+    if (in_fd < 0)
+        fail("cannot open input", name);
+
+    fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void file_step(void)
+{
+    const double t = now() + latency();
+
+    uint8_t d[4096];
+    ssize_t n;
+
+    while ((n = read(in_fd, d, sizeof (d))) > 0)
+        frame_bytes(&frame, d, (size_t) n, t);
+
+    /* At the end of a file or stdin, stop reading but keep playing. */
+
+    if (n == 0)
+        in_eof = 1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void in_init(const char *name)
+{
+    if      (strcmp (name, "none")   == 0)
+        return;
+    else if (strcmp (name, "seq")    == 0)
+        seq_init(NULL);
+    else if (strncmp(name, "seq:", 4) == 0)
+        seq_init(name + 4);
+    else if (strncmp(name, "raw:", 4) == 0)
+        raw_init(name + 4);
+    else
+        file_init(name);
+}
+
+static int in_poll(struct pollfd *fd, int n)
+{
+    if (seq)
+        return snd_seq_poll_descriptors(seq, fd, n, POLLIN);
+    if (raw)
+        return snd_rawmidi_poll_descriptors(raw, fd, n);
+
+    if (in_fd >= 0 && !in_eof && n > 0)
+    {
+        fd[0].fd     = in_fd;
+        fd[0].events = POLLIN;
+        return 1;
+    }
+    return 0;
+}
+
+static void in_step(void)
+{
+    if (seq)
+        seq_step();
+    if (raw)
+        raw_step();
+    if (in_fd >= 0 && !in_eof)
+        file_step();
+}
+
+static void in_fini(void)
+{
+    if (seq)
+        snd_seq_close(seq);
+    if (raw)
+        snd_rawmidi_close(raw);
+    if (in_fd > STDIN_FILENO)
+        close(in_fd);
+}
+
+/*===========================================================================*/
+/* Audio output                                                              */
+
+/* Output goes to an ALSA PCM device, or to a null sink or a file of raw     */
+/* 16-bit stereo.  The latter two render in real time on the monotonic       */
+/* clock, as if to a device with the same buffer.                            */
+
+static snd_pcm_t         *pcm      = NULL;
+static snd_pcm_access_t   pcm_access;
+static struct snth_format pcm_format = { SNTH_FORMAT_S16, 0, 0 };
+static FILE              *out_fp   = NULL;
+static double             out_next = 0.0;
+static short             *buffer;
+
+/*---------------------------------------------------------------------------*/
+
+static void pcm_clock(void)
+{
+    snd_pcm_uframes_t avail;
+    snd_htimestamp_t  t;
+
+    /* The next frame written plays once all queued frames have played. */
+    /* Fall back on the current time before the stream has a timestamp. */
+
+    if (snd_pcm_htimestamp(pcm, &avail, &t) == 0 && (t.tv_sec || t.tv_nsec))
+        snth_set_clock((double) t.tv_sec + (double) t.tv_nsec / 1000000000.0
+                     + (double) (buffer_size - avail) / RATE);
+    else
+        snth_set_clock(now());
+}
+
+static void pcm_xrun(int e)
+{
+    fprintf(stderr, "snthd: %s\n", snd_strerror(e));
+
+    snd_pcm_prepare(pcm);
+}
+
+static void pcm_start(void)
+{
+    /* A mapped stream does not start itself as a written one does.  Start */
+    /* it once the buffer is full, as the start threshold asks.            */
+
+    if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED &&
+        snd_pcm_avail_update(pcm) == 0)
+        snd_pcm_start(pcm);
+}
+
+static void pcm_mmap(snd_pcm_uframes_t count)
+{
+    const snd_pcm_channel_area_t *a;
+
+    snd_pcm_uframes_t o;
+    snd_pcm_uframes_t n;
+    snd_pcm_sframes_t e;
+
+    void *dst[2];
+
+    /* Render straight into the device buffer, in pieces where it wraps. */
+
+    while (count > 0)
+    {
+        n = count;
+
+        if ((e = snd_pcm_mmap_begin(pcm, &a, &o, &n)) < 0)
+        {
+            pcm_xrun((int) e);
+            break;
+        }
+
+        dst[0] = (char *) a[0].addr + (a[0].first + o * a[0].step) / 8;
+        dst[1] = (char *) a[1].addr + (a[1].first + o * a[1].step) / 8;
+
+        snth_render(dst, n, &pcm_format);
+
+        if ((e = snd_pcm_mmap_commit(pcm, o, n)) < 0)
+        {
+            pcm_xrun((int) e);
+            break;
+        }
+        pcm_start();
+
+        count -= n;
+    }
+}
+
+/* Access modes and formats are taken in order of preference, as in        */
+/* SNTHGUI.                                                                */
+
+static const snd_pcm_access_t pcm_accesses[] = {
+    SND_PCM_ACCESS_MMAP_INTERLEAVED,
+    SND_PCM_ACCESS_MMAP_NONINTERLEAVED,
+    SND_PCM_ACCESS_RW_INTERLEAVED,
+};
+
+static const struct
+{
+    snd_pcm_format_t alsa;
+    int              snth;
+}
+pcm_formats[] = {
+    { SND_PCM_FORMAT_S16,   SNTH_FORMAT_S16 },
+    { SND_PCM_FORMAT_S32,   SNTH_FORMAT_S32 },
+    { SND_PCM_FORMAT_S24,   SNTH_FORMAT_S24 },
+    { SND_PCM_FORMAT_FLOAT, SNTH_FORMAT_F32 },
+};
+
+#define NACCESS (sizeof (pcm_accesses) / sizeof (pcm_accesses[0]))
+#define NFORMAT (sizeof (pcm_formats)  / sizeof (pcm_formats[0]))
+
+static void pcm_init(const char *name)
+{
+    snd_pcm_hw_params_t *hw;
+    snd_pcm_sw_params_t *sw;
+
+    snd_pcm_stream_t stream = SND_PCM_STREAM_PLAYBACK;
+    snd_pcm_format_t format;
+
+    size_t i;
+    size_t j;
+
+    unsigned int channels    = 2;
+    unsigned int rate        = RATE;
+    unsigned int period_time = (unsigned int) (1000000 * period_size / RATE);
+    unsigned int buffer_time = (unsigned int) (1000000 * buffer_size / RATE);
+
+    int d = 1;
+
+    snd_ck(snd_pcm_open(&pcm, name, stream, 0));
+
+    /* Set hardware parameters, asking for the period and buffer by time. */
+
+    snd_ck(snd_pcm_hw_params_malloc(&hw));
+
+    snd_ck(snd_pcm_hw_params_any                 (pcm, hw));
+
+    /* Take the first access mode and format that the device offers. */
+
+    for (i = 0; i < NACCESS - 1; ++i)
+        if (snd_pcm_hw_params_test_access(pcm, hw, pcm_accesses[i]) == 0)
+            break;
+
+    pcm_access = pcm_accesses[i];
+
+    snd_ck(snd_pcm_hw_params_set_access          (pcm, hw, pcm_access));
+
+    for (j = 0; j < NFORMAT - 1; ++j)
+        if (snd_pcm_hw_params_test_format(pcm, hw, pcm_formats[j].alsa) == 0)
+            break;
+
+    format            = pcm_formats[j].alsa;
+    pcm_format.type   = pcm_formats[j].snth;
+    pcm_format.planar = (pcm_access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
+
+    snd_ck(snd_pcm_hw_params_set_format          (pcm, hw, format));
+    snd_ck(snd_pcm_hw_params_set_channels        (pcm, hw, channels));
+    snd_ck(snd_pcm_hw_params_set_rate_near       (pcm, hw, &rate, 0));
+
+    snd_ck(snd_pcm_hw_params_set_buffer_time_near(pcm, hw, &buffer_time, &d));
+    snd_ck(snd_pcm_hw_params_set_period_time_near(pcm, hw, &period_time, &d));
+    snd_ck(snd_pcm_hw_params                     (pcm, hw));
+
+    snd_ck(snd_pcm_hw_params_get_buffer_size(hw, &buffer_size));
+    snd_ck(snd_pcm_hw_params_get_period_size(hw, &period_size, &d));
+
+    snd_pcm_hw_params_free(hw);
+
+    /* Set software parameters. */
+
+    snd_ck(snd_pcm_sw_params_malloc(&sw));
+
+    snd_ck(snd_pcm_sw_params_current            (pcm, sw));
+    snd_ck(snd_pcm_sw_params_set_avail_min      (pcm, sw, period_size));
+    snd_ck(snd_pcm_sw_params_set_start_threshold(pcm, sw, buffer_size));
+    snd_ck(snd_pcm_sw_params_set_tstamp_mode    (pcm, sw,
+                                                 SND_PCM_TSTAMP_ENABLE));
+    snd_ck(snd_pcm_sw_params_set_tstamp_type    (pcm, sw,
+                                         SND_PCM_TSTAMP_TYPE_MONOTONIC));
+    snd_ck(snd_pcm_sw_params                    (pcm, sw));
+
+    snd_pcm_sw_params_free(sw);
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void out_chunk(snd_pcm_uframes_t count)
+{
+    int e;
+
+    /* Render a chunk of audio and send it to the output. */
+
+    if (pcm)
+    {
+        pcm_clock();
+
+        if (pcm_access == SND_PCM_ACCESS_RW_INTERLEAVED)
+        {
+            void *dst[1] = { buffer };
+
+            snth_render(dst, count, &pcm_format);
+
+            if ((e = snd_pcm_writei(pcm, buffer, count)) < 0)
+                pcm_xrun(e);
+        }
+        else
+            pcm_mmap(count);
+    }
+    else
+    {
+        snth_set_clock(out_next + (double) buffer_size / RATE);
+        snth_get_output(buffer, count);
+
+        if (out_fp && fwrite(buffer, 4, count, out_fp) < count)
+            quit = 1;
+
+        out_next += (double) count / RATE;
+    }
+}
+
+static void out_init(const char *name)
+{
+    if      (strcmp (name, "alsa")    == 0)
+        pcm_init("default");
+    else if (strncmp(name, "alsa:", 5) == 0)
+        pcm_init(name + 5);
+    else if (strcmp (name, "-")       == 0)
+        out_fp = stdout;
+    else if (strcmp (name, "null")    != 0)
+    {
+        if ((out_fp = fopen(name, "wb")) == NULL)
+            fail("cannot open output", name);
+    }
+
+    /* Acquire a working buffer wide enough for any format, and begin. */
+
+    buffer = (short *) calloc(period_size * 2, sizeof (float));
+
+    out_next = now();
+    out_chunk(period_size);
+    out_chunk(period_size);
+}
+
+static int out_poll(struct pollfd *fd, int n)
+{
+    return pcm ? snd_pcm_poll_descriptors(pcm, fd, n) : 0;
+}
+
+static int out_wait(void)
+{
+    /* Wake for the next period when rendering on the clock. */
+
+    if (pcm)
+        return 100;
+    else
+        return (int) ceil(fmax(out_next - now(), 0.0) * 1000.0);
+}
+
+static void out_step(void)
+{
+    int avail;
+
+    if (pcm)
+    {
+        /* Fill all available PCM output buffer space. */
+
+        for (avail  = (int) snd_pcm_avail_update(pcm);
+             avail >= (int) period_size;
+             avail  = (int) snd_pcm_avail_update(pcm))
+            out_chunk(period_size);
+
+        if (avail < 0)
+            pcm_xrun(avail);
+    }
+    else
+    {
+        const double t = now();
+
+        /* Render each period as it comes due.  If far behind, skip ahead. */
+
+        if (t - out_next > (double) buffer_size / RATE)
+            out_next = t;
+
+        while (out_next <= t && !quit)
+            out_chunk(period_size);
+    }
+}
+
+static void out_fini(void)
+{
+    if (pcm)
+    {
+        snd_pcm_drop(pcm);
+        snd_pcm_close(pcm);
+    }
+    if (out_fp && out_fp != stdout)
+        fclose(out_fp);
+    else if (out_fp)
+        fflush(out_fp);
+
+    free(buffer);
+}
+
+/*===========================================================================*/
+
+static void init(const char *name)
+{
+    char midi[MAXMIDI];
+
+    FILE  *fp;
+    size_t sz;
+
+    /* If a state file was named, read SNTH state from it. */
+
+    if (name && (fp = fopen(name, "rb")))
+    {
+        if ((sz = fread(midi, 1, MAXMIDI, fp)) > 0)
+            snth_midi(midi, sz);
+
+        fclose(fp);
+    }
+
+    snth_set_channel(0);
+    snth_set_bank   (0);
+    snth_set_patch  (0);
+}
+
+static void fini(const char *name)
+{
+    char midi[MAXMIDI];
+
+    FILE  *fp;
+    size_t sz;
+
+    /* If a state file was named, write SNTH state to it. */
+
+    if (name && (fp = fopen(name, "wb")))
+    {
+        if ((sz = snth_dump_state(midi, MAXMIDI)) > 0)
+            fwrite(midi, 1, sz, fp);
+
+        fclose(fp);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void stop(int sig)
+{
+    quit = 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "Usage: %s [-i input] [-o output] [-p period] [-b buffer] [state]\n"
+        "  input   seq, seq:client:port, raw:device, a FIFO or file, -, none\n"
+        "  output  alsa, alsa:device, null, a file, -\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *input  = "seq";
+    const char *output = "alsa";
+    const char *state  = NULL;
+    const char *port;
+    const char *rt;
+
+    struct pollfd    fd[MAXPOLL];
+    struct sigaction sa;
+
+    int c;
+    int i;
+    int o;
+
+    /* Parse the command line. */
+
+    while ((c = getopt(argc, argv, "i:o:p:b:")) != -1)
+        switch (c)
+        {
+        case 'i': input       = optarg;                            break;
+        case 'o': output      = optarg;                            break;
+        case 'p': period_size = (snd_pcm_uframes_t) atoi(optarg);  break;
+        case 'b': buffer_size = (snd_pcm_uframes_t) atoi(optarg);  break;
+        default:  usage(argv[0]);
+        }
+
+    if (optind < argc)
+        state = argv[optind];
+    if (period_size == 0 || buffer_size < period_size)
+        usage(argv[0]);
+
+    /* Stop cleanly on a signal, interrupting the poll. */
+
+    memset(&sa, 0, sizeof (sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Set. */
+
+    snth_init(RATE);
+    init(state);
+
+    out_init(output);
+    in_init(input);
+
+    if ((port = getenv("SNTH_OSC")))
+        osc_init(atoi(port), latency());
+
+    /* Enter real-time mode last, so the OSC thread does not inherit it. */
+
+    if ((rt = getenv("SNTH_RT")))
+        rt_init(rt);
+
+    /* Go. */
+
+    while (!quit)
+    {
+        i = in_poll(fd, MAXPOLL);
+        o = out_poll(fd + i, MAXPOLL - i);
+
+        if (poll(fd, i + o, out_wait()) < 0)
+            continue;
+
+        /* Let the PCM plugin consume its own poll events. */
+
+        if (pcm && o > 0)
+        {
+            unsigned short e;
+
+            snd_pcm_poll_descriptors_revents(pcm, fd + i, o, &e);
+        }
+
+        in_step();
+        out_step();
+    }
+
+    osc_fini();
+    in_fini();
+    out_fini();
+    fini(state);
+
+    return 0;
+}